@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>	// to use fork()
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>	// to use wait4()
+#include <sys/wait.h>
+
+// #define DEBUG
+
+#define BUILD_FILE "./main.out"
+#define WORKLOAD_FILE "./workload.out"
+// workload and memory report go to files of their own, made by mkstemp from these templates
+#define INPUT_TEMPLATE "/tmp/benchInputXXXXXX"
+#define REPORT_TEMPLATE "/tmp/benchMemoryXXXXXX"
+#define MAX_STRING_SIZE 1000
+#define MAX_OPTIONS 32
+#define NUM_COMMANDS 200000
+
+const char *FAMILIES[] = {"writeonly", "bulkreads", "timeforachange", "rollingback", "alterninghistory", "rollercoaster", NULL};
+// categories of the memory report of the editor, the last one is their total
+const char *CATEGORIES[] = {"lines", "nodes", "versions", "commands", "total", NULL};
+#define NUM_CATEGORIES 5
+
+typedef struct result
+{
+	long elapsed;
+	long peakMemory;
+	// peak bytes counted by the editor for each category
+	long peaks[NUM_CATEGORIES];
+	int status;
+} t_result;
+
+t_result runEditor(char **, char *, char *);
+int redirect(char *, int, int);
+void readReport(t_result *, char *);
+int createTemporary(char *);
+long getTimeMillis();
+
+// every family is generated with the same seed and run once, options after the seed go to the editor
+int main(int argc, char *argv[])
+{
+	long numCommands = argc > 1 ? atol(argv[1]) : NUM_COMMANDS;
+	char *seed = argc > 2 ? argv[2] : "1";
+	char *arguments[MAX_OPTIONS];
+	char command[MAX_STRING_SIZE];
+	char inputPath[] = INPUT_TEMPLATE;
+	char reportPath[] = REPORT_TEMPLATE;
+	int numArguments = 0;
+	t_result result;
+
+	if (createTemporary(inputPath) != 0 || createTemporary(reportPath) != 0)
+	{
+		perror("Unable to create temporary files");
+		unlink(inputPath);
+		return 1;
+	}
+
+	arguments[numArguments++] = BUILD_FILE;
+	arguments[numArguments++] = "--memory";
+	for (int i = 3; i < argc && numArguments < MAX_OPTIONS - 1; i++)
+		arguments[numArguments++] = argv[i];
+	arguments[numArguments] = NULL;
+
+	printf("%-18s %10s %10s %14s %12s", "family", "commands", "wall ms", "commands/s", "peak RSS MB");
+	for (int i = 0; CATEGORIES[i] != NULL; i++)
+		printf(" %9s MB", CATEGORIES[i]);
+	printf("\n");
+	for (int i = 0; FAMILIES[i] != NULL; i++)
+	{
+		sprintf(command, "%s %s %ld %s > %s", WORKLOAD_FILE, FAMILIES[i], numCommands, seed, inputPath);
+		if (system(command) != 0)
+		{
+			puts("Unable to generate workload");
+			unlink(inputPath);
+			unlink(reportPath);
+			return 1;
+		}
+
+		result = runEditor(arguments, inputPath, reportPath);
+		if (result.status != 0)
+			printf("%-18s failed with status %d\n", FAMILIES[i], result.status);
+		else
+		{
+			printf("%-18s %10ld %10ld %14.0f %12.1f", FAMILIES[i], numCommands, result.elapsed, numCommands * 1000.0 / (result.elapsed > 0 ? result.elapsed : 1), result.peakMemory / 1024.0);
+			for (int j = 0; j < NUM_CATEGORIES; j++)
+				printf(" %12.1f", result.peaks[j] / (1024.0 * 1024.0));
+			printf("\n");
+		}
+		fflush(stdout);
+	}
+
+	unlink(inputPath);
+	unlink(reportPath);
+	return 0;
+}
+
+// editor reads the workload on stdin, its output is not kept and its memory report is read at exit
+t_result runEditor(char **arguments, char *inputPath, char *reportPath)
+{
+	struct rusage usage;
+	t_result result;
+	long start = getTimeMillis();
+	pid_t editor;
+
+	editor = fork();
+	if (editor == 0)
+	{
+		// the run is reported as failed when a stream cannot be set up
+		if (redirect(inputPath, O_RDONLY, STDIN_FILENO) != 0 || redirect("/dev/null", O_WRONLY, STDOUT_FILENO) != 0 || redirect(reportPath, O_WRONLY | O_TRUNC, STDERR_FILENO) != 0)
+			_exit(126);
+		execv(BUILD_FILE, arguments);
+		perror(BUILD_FILE);
+		_exit(127);
+	}
+
+	wait4(editor, &result.status, 0, &usage);
+	result.elapsed = getTimeMillis() - start;
+	// maximum resident set size is in kilobytes on linux
+	result.peakMemory = usage.ru_maxrss;
+	readReport(&result, reportPath);
+
+	#ifdef DEBUG
+		printf("user %ld ms, system %ld ms\n", usage.ru_utime.tv_sec * 1000 + usage.ru_utime.tv_usec / 1000, usage.ru_stime.tv_sec * 1000 + usage.ru_stime.tv_usec / 1000);
+	#endif
+
+	return result;
+}
+
+// open a file as one of the standard streams of the editor, -1 when it cannot be opened
+int redirect(char *path, int flags, int stream)
+{
+	int file = open(path, flags);
+
+	if (file < 0 || dup2(file, stream) < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	close(file);
+	return 0;
+}
+
+// peaks of the categories printed by --memory, categories missing from the report stay at 0
+void readReport(t_result *result, char *reportPath)
+{
+	char line[MAX_STRING_SIZE];
+	char name[MAX_STRING_SIZE];
+	long current;
+	long peak;
+	FILE *report = fopen(reportPath, "r");
+
+	memset(result->peaks, 0, sizeof(result->peaks));
+	if (report == NULL)
+		return;
+	while (fgets(line, MAX_STRING_SIZE, report) != NULL)
+		if (sscanf(line, "memory %[^:]: %ld bytes, peak %ld bytes", name, &current, &peak) == 3)
+			for (int i = 0; CATEGORIES[i] != NULL; i++)
+				if (strcmp(CATEGORIES[i], name) == 0)
+					result->peaks[i] = peak;
+	fclose(report);
+}
+
+// create an empty file from a template ending in XXXXXX, nobody else can have its name
+int createTemporary(char *path)
+{
+	int file = mkstemp(path);
+
+	if (file < 0)
+		return -1;
+	close(file);
+	return 0;
+}
+
+long getTimeMillis()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
@@ -1,45 +1,620 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sched.h>
 
 #define MAX_LINE_LENGTH 1024
-#define HISTORY_BUFFER_SIZE 100
-#define TEXT_BUFFER_SIZE 1000
+#define HISTORY_BUFFER_SIZE 1024
+#define INPUT_BUFFER_SIZE 65536
+#define LOOKAHEAD_WINDOW_SIZE 256
+#define SEGMENT_BUFFER_SIZE 64
+// lazy edits composed before their version is built
+#define MAX_COMPOSED_EDITS 256
+// journal is written and synced after this many commands or milliseconds
+#define JOURNAL_SYNC_COMMANDS 1024
+#define JOURNAL_SYNC_INTERVAL 100
+#define JOURNAL_BUFFER_SIZE 65536
+
+// snapshot sections start on a page
+#define SNAPSHOT_ALIGNMENT 4096
+#define SNAPSHOT_MAGIC "EDSNAP2"
+// journal commands replayed at most to reach any command from the index
+#define REPLAY_INDEX_INTERVAL 16384
+// events read at once by the server
+#define SERVER_EVENTS 64
+// commands of a session run before other sessions of the worker get their turn
+#define SESSION_BATCH_COMMANDS 1024
+#define DEQUE_SIZE 64
+// ring file starts with a page of counters, each ring size is a power of two
+#define RING_MAGIC "EDRING1"
+#define RING_HEADER_SIZE 4096
+#define RING_SIZE (1 << 20)
+#define MAX_RING_SIZE (1 << 30)
+// prints of fewer lines are not worth splitting between threads
+#define PARALLEL_PRINT_LINES 65536
+// commands parsed or outputs waiting for render before the stage in front waits
+#define PIPELINE_QUEUE_SIZE 1024
+
+// nodes are allocated in chunks that never move
+#define NODE_CHUNK_BITS 16
+#define NODE_CHUNK_SIZE (1 << NODE_CHUNK_BITS)
+#define MAX_NODE_CHUNKS 65536
+
+// fingerprints are polynomials over line hashes modulo a Mersenne prime
+#define FINGERPRINT_PRIME ((1ULL << 61) - 1)
+#define FINGERPRINT_BASE 0x1f3d5b79a2c4e687ULL
+// fingerprint of a node not computed yet
+#define NO_FINGERPRINT ~0ULL
+
+// latencies are counted in 2^HISTOGRAM_SUB_BITS buckets for each power of two, within about 3%
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_BUCKETS (64 << HISTOGRAM_SUB_BITS)
+// command types with counters of their own, other types share one more
+#define COMMAND_TYPES "cdpurvhs"
+
+// last events kept for every thread by the trace
+#define TRACE_EVENTS 65536
+// an event site costs one branch when tracing is off
+#define TRACE(name, phase, argument) if (__builtin_expect(__atomic_load_n(&traceEnabled, __ATOMIC_RELAXED) == true, 0)) traceEvent(name, phase, argument)
+// an allocation site costs one branch without --memory
+#define COUNT_MEMORY(category, bytes) if (__builtin_expect(memoryEnabled == true, 0)) countMemory(category, bytes)
+
+// hardware counters read by --perf, with the task clock that is there when they are not
+#define PERF_EVENTS 5
+// end of a phase of a command, one branch when counters are off
+#define PHASE(type, phase) if (__builtin_expect(perf.enabled == true, 0)) countPhase(type, phase)
+
+// node 0 is the empty tree
+#define EMPTY_TREE 0
+// root of a version whose text is not built yet
+#define NOT_BUILT -1
 
 /* ---------------------------
  * ---------- TYPES ----------
  * ---------------------------
  */
 
+// allocations counted by the memory report
+typedef enum memoryCategory {
+    LINE_MEMORY,
+    NODE_MEMORY,
+    VERSION_MEMORY,
+    COMMAND_MEMORY,
+    MEMORY_CATEGORIES
+} t_memoryCategory;
+
+// phases of a command counted by --perf, commands outside of them are not counted
+typedef enum phase {
+    PARSE_PHASE,
+    EXECUTE_PHASE,
+    UPDATE_PHASE,
+    PRINT_PHASE,
+    NUM_PHASES
+} t_phase;
+
 typedef enum boolean {
     false, true
 } t_boolean;
 
+typedef struct node {
+    int left;
+    int right;
+    // number of lines in the subtree
+    int size;
+    unsigned int priority;
+    // address of the line from the node itself, so nodes work wherever they are mapped
+    long line;
+} t_node;
+
+typedef struct store {
+    t_node *chunks[MAX_NODE_CHUNKS];
+    int numNodes;
+    unsigned int seed;
+    // fingerprints of the subtrees of each chunk, computed when first asked
+    unsigned long long *fingerprints[MAX_NODE_CHUNKS];
+    // powers of the fingerprint base, grown with the largest tree
+    unsigned long long *powers;
+    int numPowers;
+    // nodes created as copies of others, on the path from an edit to the root
+    long numCopies;
+} t_store;
+
 typedef struct text {
-    char **lines;
+    t_store *store;
+    int root;
     int numLines;
-    int buffersAllocated;
 } t_text;
 
+typedef struct lines {
+    char **lines;
+    int numLines;
+} t_lines;
+
 typedef struct command {
     char type;
     int start;
     int end;
-    t_text data;
-    t_text prevData;
-    struct command *next;
-    t_boolean deleteWorks;
+    t_lines data;
+    // edit is applied only when its text is needed
+    t_boolean lazy;
 } t_command;
 
+typedef struct version {
+    int parent;
+    // ancestor used to skip many versions at once
+    int jump;
+    int depth;
+    int root;
+    int numLines;
+    // edit from parent, kept until text is built
+    t_command *command;
+} t_version;
+
+// lines of a change, or lines of a tree from start when lines is NULL
+typedef struct segment {
+    int root;
+    int start;
+    int numLines;
+    char **lines;
+} t_segment;
+
+// net edit of many commands as a list of segments
+typedef struct delta {
+    t_segment *segments;
+    int numSegments;
+    int segmentsAllocated;
+    int numLines;
+} t_delta;
+
 typedef struct history {
-    t_command *pastCommands;
+    t_version *versions;
+    int numVersions;
+    int versionsAllocated;
+    // versions are read from a snapshot and cannot be reallocated
+    t_boolean versionsMapped;
+    int currentVersion;
+    // last version reachable with redo
+    int lastVersion;
+    // version whose text is in the text struct
+    int textVersion;
     int numPastCommands;
-    t_command *futureCommands;
     int numFutureCommands;
     t_boolean timeTravelMode;
-    int commandsToTravel;
+    int numLazyCommands;
+    int maxLazyCommands;
 } t_history;
 
+typedef struct input {
+    char *buffer;
+    long size;
+    long offset;
+} t_input;
+
+typedef struct options {
+    t_boolean offline;
+    int lookahead;
+    char *snapshot;
+    t_boolean snapshotFork;
+    char *restore;
+    char *journal;
+    int journalCommands;
+    int journalInterval;
+    char *replay;
+    char *replayIndex;
+    int replayInterval;
+    long seek;
+    char *server;
+    int threads;
+    int readers;
+    char *ring;
+    long ringSize;
+    char *batch;
+    int printThreads;
+    t_boolean pipeline;
+    char *trace;
+    t_boolean memory;
+    t_boolean work;
+    t_boolean perf;
+} t_options;
+
+// header of a command in the journal, followed by the command as read
+typedef struct record {
+    unsigned int size;
+    unsigned int checksum;
+} t_record;
+
+// header of a snapshot file, followed by nodes, versions and lines
+typedef struct snapshot {
+    char magic[8];
+    // snapshots are read only by the same build
+    int nodeSize;
+    int versionSize;
+    int numNodes;
+    unsigned int seed;
+    int numVersions;
+    int currentVersion;
+    int lastVersion;
+    int textVersion;
+    int numPastCommands;
+    int numFutureCommands;
+    int timeTravelMode;
+    // journal commands already in the snapshot
+    long journalOffset;
+    // last of those commands, an index is used only with the journal that still has it
+    long lastRecordOffset;
+    unsigned int lastRecordChecksum;
+    long nodesOffset;
+    long versionsOffset;
+    long linesOffset;
+    // points of a replay index, none for a session snapshot
+    long pointsOffset;
+    int numPoints;
+    long size;
+} t_snapshot;
+
+// history after some commands of a journal, every version it uses is older
+typedef struct replayPoint {
+    long command;
+    // record of the next command
+    long journalOffset;
+    int numVersions;
+    int currentVersion;
+    int lastVersion;
+    int numPastCommands;
+    int numFutureCommands;
+    int timeTravelMode;
+} t_replayPoint;
+
+typedef struct replayIndex {
+    t_replayPoint *points;
+    int numPoints;
+    int pointsAllocated;
+    int interval;
+    // last record indexed
+    long lastRecordOffset;
+    unsigned int lastRecordChecksum;
+} t_replayIndex;
+
+// offset in the snapshot of a line already saved
+typedef struct savedLine {
+    char *line;
+    long offset;
+} t_savedLine;
+
+typedef struct journal {
+    int file;
+    // records of the next group
+    char *buffer;
+    long size;
+    long allocated;
+    int numPendingCommands;
+    int syncCommands;
+    int syncInterval;
+    long lastSync;
+    // group being written by the writer thread
+    char *syncBuffer;
+    long syncSize;
+    long syncAllocated;
+    t_boolean syncPending;
+    t_boolean closing;
+    // a group could not be written, nothing is journaled after it
+    t_boolean failed;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} t_journal;
+
+// bytes received or printed by a session of the server
+typedef struct buffer {
+    char *data;
+    long size;
+    long allocated;
+} t_buffer;
+
+// output of a session waiting to be sent in order, a print given to the readers is not done until it is rendered
+typedef struct output {
+    t_buffer buffer;
+    t_boolean done;
+    // published version and lines of a print
+    t_text text;
+    int start;
+    int end;
+    struct session *session;
+    // next output of the session and next print for the readers
+    struct output *next;
+    struct output *nextPrint;
+} t_output;
+
+typedef struct session {
+    int socket;
+    int poll;
+    t_text text;
+    t_history history;
+    // commands received and not executed yet
+    t_buffer input;
+    t_buffer output;
+    // session is waiting in the queue or run by a worker
+    t_boolean scheduled;
+    // quit is executed
+    t_boolean finished;
+    // client closed the connection
+    t_boolean closed;
+    // worker that ran the session last, it is queued there again
+    int worker;
+    pthread_mutex_t lock;
+    // outputs in command order, sent with the output lock held
+    t_output *firstOutput;
+    t_output *lastOutput;
+    // bytes the socket could not take yet, sent when it is writable again
+    t_buffer unsent;
+    // socket is watched for commands until the client ends them, and for room while output is unsent
+    t_boolean reading;
+    t_boolean writing;
+    // connection is shut down after the last output
+    t_boolean quit;
+    // session is freed when its worker and every print of its versions let it go
+    int pins;
+    pthread_mutex_t outputLock;
+} t_session;
+
+// sessions queued on a worker, the worker takes the oldest and other workers steal the newest
+typedef struct deque {
+    t_session **sessions;
+    int first;
+    int size;
+    int allocated;
+    pthread_mutex_t lock;
+} t_deque;
+
+typedef struct worker {
+    struct server *server;
+    int id;
+    t_deque deque;
+    // choice of the first worker to steal from
+    unsigned int seed;
+    pthread_t thread;
+} t_worker;
+
+typedef struct server {
+    int socket;
+    int poll;
+    int lookahead;
+    t_worker *workers;
+    int numWorkers;
+    // worker of the next new session
+    int nextWorker;
+    // sessions in all deques and workers waiting for one
+    int numQueued;
+    int numSleeping;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    // prints waiting for a reader
+    t_output *firstPrint;
+    t_output *lastPrint;
+    pthread_t *readers;
+    int numReaders;
+    pthread_mutex_t printsLock;
+    pthread_cond_t printsReady;
+    // threads end after what they run, so that the trace is written once they are gone
+    t_boolean stopping;
+} t_server;
+
+// one direction of a ring file, head and tail count bytes written and read and wrap around
+typedef struct ring {
+    unsigned int head;
+    unsigned int tail;
+    // changes after head moves or the ring is closed, the reader sleeps on it and the writer on tail
+    unsigned int events;
+    // side sleeping, the other side wakes it
+    int readerWaiting;
+    int writerWaiting;
+} t_ring;
+
+// start of a ring file shared with a client, followed by the data of the commands ring and of the prints ring
+typedef struct ringFile {
+    char magic[8];
+    unsigned int size;
+    // editor quit, the prints ring has its last bytes
+    int closed;
+    t_ring commands;
+    t_ring prints;
+} t_ringFile;
+
+// input file of a batch and where its prints go
+typedef struct job {
+    char *input;
+    char *output;
+    long size;
+} t_job;
+
+// jobs of a batch, threads take the next one until none is left
+typedef struct batch {
+    t_job *jobs;
+    int numJobs;
+    int nextJob;
+    int numFailed;
+} t_batch;
+
+// lines of a large print formatted by one thread
+typedef struct printRange {
+    t_text *text;
+    int start;
+    int end;
+    t_buffer buffer;
+    pthread_t thread;
+} t_printRange;
+
+// bounded queue between two stages of the pipeline, with the depths it went through
+typedef struct stageQueue {
+    void **items;
+    int size;
+    int first;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    long numPushes;
+    long totalDepth;
+    int maxDepth;
+    // times the stage behind found the queue full, and the stage in front found it empty
+    long numFull;
+    long numEmpty;
+} t_stageQueue;
+
+// stages reading commands and rendering outputs around the one executing them
+typedef struct pipeline {
+    t_input *source;
+    t_stageQueue commands;
+    t_stageQueue outputs;
+    pthread_t parser;
+    pthread_t renderer;
+} t_pipeline;
+
+// text and history of a finished session, left to the reclaimer
+typedef struct garbage {
+    t_text text;
+    t_history history;
+    struct garbage *next;
+} t_garbage;
+
+// texts waiting for the thread that frees them
+typedef struct reclaimer {
+    t_garbage *first;
+    // texts given and not freed yet
+    int numPending;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t idle;
+    pthread_once_t started;
+    pthread_t thread;
+} t_reclaimer;
+
+// latencies of commands of one type, in nanoseconds
+typedef struct histogram {
+    long counts[HISTOGRAM_BUCKETS];
+    long total;
+    long max;
+} t_histogram;
+
+// event of a thread, phase is B and E around a span or i for an instant
+typedef struct traceEvent {
+    const char *name;
+    long time;
+    long argument;
+    char phase;
+} t_traceEvent;
+
+// last events of a thread, the oldest are overwritten
+typedef struct traceBuffer {
+    t_traceEvent events[TRACE_EVENTS];
+    long numEvents;
+    // thread is adding an event, the buffer is not read meanwhile
+    int busy;
+    int thread;
+    struct traceBuffer *next;
+} t_traceBuffer;
+
+// buffers of every thread, written to the file at exit
+typedef struct trace {
+    char *path;
+    long start;
+    t_traceBuffer *first;
+    pthread_mutex_t lock;
+} t_trace;
+
+// work done by the commands of one type in the main loop
+typedef struct work {
+    long numCommands;
+    // lines given to changes and ranges of deletes
+    long linesEdited;
+    // nodes copied on the paths to the roots and nodes of new lines
+    long nodesCopied;
+    long nodesCreated;
+    long bytesCopied;
+} t_work;
+
+// counter that --perf tries to open
+typedef struct perfEvent {
+    char *name;
+    unsigned int type;
+    unsigned long long config;
+} t_perfEvent;
+
+// counters of the main thread, by command type and phase
+typedef struct perf {
+    t_boolean enabled;
+    // counters are read together through the first one opened
+    int leader;
+    int numOpened;
+    // position of each event in a read of the group, -1 when it is not available
+    int positions[PERF_EVENTS];
+    unsigned long long last[PERF_EVENTS];
+    unsigned long long counts[sizeof(COMMAND_TYPES)][NUM_PHASES][PERF_EVENTS];
+    long numCommands[sizeof(COMMAND_TYPES)];
+    // counters run less than they are enabled when the hardware has too few of them
+    unsigned long long timeEnabled;
+    unsigned long long timeRunning;
+} t_perf;
+
+// bytes of a category in use, and the most it ever had
+typedef struct memoryCounter {
+    long current;
+    long peak;
+} t_memoryCounter;
+
+// prints go to this buffer when set, to stdout otherwise
+__thread t_buffer *printBuffer = NULL;
+// threads formatting a large print
+int printThreads = 1;
+#ifdef LATENCY
+// histograms of the commands executed by the main loop
+t_histogram latencies[sizeof(COMMAND_TYPES)];
+// set by SIGUSR1, the main loop prints the histograms after the command it is executing
+volatile sig_atomic_t latenciesRequested = 0;
+#endif
+// set by --trace, checked by every event site
+t_boolean traceEnabled = false;
+// events of this thread, created by its first event
+__thread t_traceBuffer *traceBuffer = NULL;
+t_trace trace = {NULL, 0, NULL, PTHREAD_MUTEX_INITIALIZER};
+// set by --memory before any text is created, checked by every allocation site
+t_boolean memoryEnabled = false;
+// bytes in use by category, the last counter is their total
+t_memoryCounter memoryCounters[MEMORY_CATEGORIES + 1];
+const char *memoryNames[] = {"lines", "nodes", "versions", "commands", "total"};
+// work of the commands executed by the main loop
+t_work work[sizeof(COMMAND_TYPES)];
+const t_perfEvent perfEvents[PERF_EVENTS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"task ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK}
+};
+const char *phaseNames[NUM_PHASES] = {"parse", "execute", "update", "print"};
+t_perf perf;
+// set by SIGUSR2 with --memory, the report is printed after the command being executed
+volatile sig_atomic_t memoryRequested = 0;
+// started by the first text given to it
+t_reclaimer reclaimer = {NULL, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_ONCE_INIT};
+
 /* --------------------------------
  * ---------- PROTOTYPES ----------
  * --------------------------------
@@ -47,8 +622,8 @@ typedef struct history {
 
 // READ COMMAND
 
-// readCommand read a command from stdin and return it
-t_command *readCommand();
+// readCommand read a command from input (stdin when NULL) and return it
+t_command *readCommand(t_input *);
 
 // readCommand read command type in the given line
 int getCommandType(char *);
@@ -60,7 +635,7 @@ int readCommandStart(t_command, char *);
 void readCommandStartAndEnd(t_command *, char *);
 
 // readCommand read command data
-t_text readCommandData(t_command);
+t_lines readCommandData(t_command, t_input *);
 
 // EXECUTE COMMAND
 
@@ -76,105 +651,575 @@ void changeCommand(t_command *, t_text *);
 // deleteCommand execute a delete command with data given
 void deleteCommand(t_command *, t_text *);
 
-// undoCommand prepare an undo command for next editing of text and history
+// editCommand execute an edit command now or leave it for the next print
+void editCommand(t_command *, t_text *, t_history *);
+
+// undoCommand move current version back to one of its ancestors
 void undoCommand(t_command *, t_text *, t_history *);
 
-// redoCommand prepare a redo command for next editing of text and history
+// redoCommand move current version forward to the last version
 void redoCommand(t_command *, t_text *, t_history *);
 
+// checkoutCommand make the given version the current one
+void checkoutCommand(t_command *, t_text *, t_history *);
+
+// fingerprintCommand print the fingerprint of the current text
+void fingerprintCommand(t_text *);
+
 // UPDATE HISTORY
 
-// createHistory create a new empty history struct
+// createHistory create a new history with only the empty version
 void createHistory(t_history *);
 
 // updateHistory check for update in history after a command execution
-void updateHistory(t_history *, t_command *);
+void updateHistory(t_history *, t_command *, t_text *);
 
 // checkForPastChanges check if past is changed than future cannot be restored
 void checkForPastChanges(t_history *, t_command *);
 
-// forgetFuture remove all commands stored in future stack
+// forgetFuture make current version the last one reachable with redo
 void forgetFuture(t_history *);
 
-// addNewEventToHistory add a new command in history
-void addNewEventToHistory(t_history *, t_command *);
+// addNewEventToHistory add a new version in history
+void addNewEventToHistory(t_history *, t_command *, t_text *);
+
+// addVersion add a child of the given version and return its id
+int addVersion(t_history *, int, t_command *);
+
+// getAncestor return the ancestor of a version at the given depth
+int getAncestor(t_history *, int, int);
+
+// loadVersion build text of current version if needed
+void loadVersion(t_history *, t_text *);
+
+// buildVersion build text of a version from its nearest built ancestor
+void buildVersion(t_history *, t_store *, int);
+
+// COMPOSE EDITS
+
+// createDelta create a delta that leaves the given text unchanged
+void createDelta(t_delta *, t_text *);
+
+// composeEdit add an edit command at the end of a delta
+void composeEdit(t_delta *, t_command *);
+
+// splitSegment split segments at the given line and return first segment after it
+int splitSegment(t_delta *, int);
+
+// replaceSegments replace lines from start to end with the given segment
+void replaceSegments(t_delta *, int, int, t_segment *);
+
+// applyDelta build text after a delta with a single edit of the tree
+void applyDelta(t_delta *, t_text *);
+
+// JOURNAL
+
+// openJournal replay commands of the journal from the given offset and open it to add new ones
+t_boolean openJournal(t_journal *, t_options *, t_text *, t_history *, long);
+
+// replayJournal execute commands of the journal and return size of valid records
+long replayJournal(t_input *, t_text *, t_history *);
+
+// readRecord read the command of the next record, NULL when it is missing or broken
+t_command *readRecord(t_input *);
+
+// drainJournal wait until every command is synced and return journal size, -1 when the journal failed
+long drainJournal(t_journal *);
+
+// journalCommand add a command to the journal before it is executed, false when the journal failed
+t_boolean journalCommand(t_journal *, t_command *);
+
+// writeNumber write a number in the given buffer and return its length
+int writeNumber(char *, int);
+
+// checkJournalBuffer make room in the journal buffer for the given bytes
+void checkJournalBuffer(t_journal *, long);
+
+// commitJournal give records of the current group to the writer thread, false when the journal failed
+t_boolean commitJournal(t_journal *);
+
+// isGroupDue tell if the current group has enough commands or waited long enough
+t_boolean isGroupDue(t_journal *, long);
+
+// writeJournal write groups of records to the journal file and sync it
+void *writeJournal(void *);
+
+// closeJournal write pending records and close the journal, false when they were not all synced
+t_boolean closeJournal(t_journal *);
+
+// getChecksum return checksum of the given bytes
+unsigned int getChecksum(char *, long);
+
+// getTimeMillis return a monotonic time in milliseconds
+long getTimeMillis();
+
+// getTimeNanos return a monotonic time in nanoseconds
+long getTimeNanos();
+
+// SNAPSHOT
+
+// saveSession write text, history and points of an index to a snapshot file
+t_boolean saveSession(char *, t_text *, t_history *, long, t_replayIndex *);
+
+// saveLines assign an offset to every different line of the store and return their size
+long saveLines(t_store *, t_savedLine *, long);
+
+// findSavedLine return the entry of a line in the table of saved lines
+t_savedLine *findSavedLine(t_savedLine *, long, char *);
+
+// startCheckpoint save the session from a child process and return its id
+pid_t startCheckpoint(char *, t_text *, t_history *, long);
+
+// waitCheckpoint check if the checkpoint is finished and return its id while it runs
+pid_t waitCheckpoint(pid_t, char *, t_boolean);
 
-// backToTheFuture revert commands to go back to the future
-void backToTheFuture(t_history *history, t_text *text);
+// restoreSession map a snapshot file as text and history and return its header
+t_snapshot *restoreSession(char *, t_text *, t_history *);
 
-// backToThePast revert commands to go back to the past
-void backToThePast(t_history *history, t_text *text);
+// REPLAY INDEX
 
-// revertCommand revert a command
-void revertCommand(t_command *, t_text *, t_boolean);
+// replaySession index a journal and print text after one of its commands
+int replaySession(t_options *);
 
-// revertCommand revert a change command
-void revertChange(t_command *command, t_text *text);
+// loadIndex read the index of a journal and return how much of the journal it covers
+long loadIndex(t_replayIndex *, char *, t_input *, t_text *, t_history *);
 
-// revertCommand revert a delete command
-void revertDeleteText(t_text *, t_command *);
+// isIndexOf tell if an index was made for the given journal
+t_boolean isIndexOf(t_snapshot *, t_input *);
 
-// moveEventBetweenStack move a command between first stack to second stack
-void moveEventBetweenStack(t_command *, t_command **, t_command **);
+// addReplayPoint add a point with the current history to the index
+void addReplayPoint(t_replayIndex *, long, long, t_history *);
+
+// seekCommand bring text and history after the given command and return commands replayed
+long seekCommand(t_replayIndex *, t_input *, long, t_text *, t_history *);
+
+// SERVER
+
+// runServer run sessions of the clients of a unix socket until the server is killed
+int runServer(t_options *);
+
+// stopServer let the threads of the server finish what they run and wait for them
+void stopServer(t_server *);
+
+// acceptClient open a new session for a client waiting on the socket
+void acceptClient(t_server *);
+
+// readClient add bytes sent by a client to the commands of its session
+void readClient(t_server *, t_session *);
+
+// writeClient send output left unsent when the socket of a client is writable again
+void writeClient(t_session *);
+
+// watchClient update the events the socket of a session is watched for
+void watchClient(t_session *, t_boolean);
+
+// scheduleSession queue a session on its worker unless it is queued or running
+void scheduleSession(t_server *, t_session *);
+
+// queueSession add a session to a worker and wake a waiting worker
+void queueSession(t_server *, int, t_session *);
+
+// runWorker run sessions of its deque and steal sessions of other workers when it is empty
+void *runWorker(void *);
+
+// takeSession remove a session from a deque, the oldest or the newest one, NULL when it is empty
+t_session *takeSession(t_deque *, t_boolean);
+
+// stealSession take the newest session of another worker
+t_session *stealSession(t_worker *);
+
+// runSession execute a batch of commands of a session and send what they print
+void runSession(t_worker *, t_session *);
+
+// getCommandSize return the size of the first command of the given bytes, 0 when it is not all received
+long getCommandSize(char *, long);
+
+// publishPrint give a print of the current version to the readers
+void publishPrint(t_server *, t_session *, t_command *);
+
+// runReader print published versions while their sessions go on
+void *runReader(void *);
+
+// queuePrinted queue what the worker printed since the last output of the session
+void queuePrinted(t_session *);
+
+// queueOutput add an output after the others of its session
+void queueOutput(t_session *, t_output *);
+
+// flushOutput send to the client the outputs of its session that are done, in order
+void flushOutput(t_session *);
+
+// sendBuffer send a buffer to a client without waiting and keep what the socket cannot take
+void sendBuffer(t_session *, t_buffer *);
+
+// finishOutput watch for room while output is unsent and shut the connection down after the last output
+void finishOutput(t_session *);
+
+// unpinSession let a session go and free it after the last one
+void unpinSession(t_session *);
+
+// closeSession close the connection of a session and free its text and history
+void closeSession(t_session *);
+
+// RING
+
+// runRing run a session on the commands a client writes to a ring file, until quit
+int runRing(t_options *);
+
+// createRingFile create a ring file for a client and map its header and rings
+t_ringFile *createRingFile(char *, unsigned int, char **, char **);
+
+// mapRing map the data of a ring twice in a row, so bytes across its end are contiguous
+char *mapRing(int, long, unsigned int);
+
+// writeRing copy bytes to a ring, waiting for the client when it is full
+void writeRing(t_ring *, char *, unsigned int, char *, long);
+
+// waitRing sleep while a counter of a ring keeps the given value
+void waitRing(unsigned int *, unsigned int, int *);
+
+// wakeRing wake the other side of a ring when it sleeps on a counter
+void wakeRing(unsigned int *, int *);
+
+// BATCH
+
+// runBatch run the input files of a list on a pool of threads, each with its own text
+int runBatch(t_options *);
+
+// readJobs read the input and output paths of every line of a list
+void readJobs(t_batch *, t_input *);
+
+// compareJobs order jobs from the largest input
+int compareJobs(const void *, const void *);
+
+// runBatchWorker run jobs of a batch until none is left
+void *runBatchWorker(void *);
+
+// runJob execute the commands of an input file and write what they print to the output file
+t_boolean runJob(t_job *);
 
 // TEXT MANAGER
 
 // createText create a new empty text struct
 void createText(t_text *);
 
+// freeText free a text with every version of its history
+void freeText(t_text *, t_history *);
+
+// reclaimText give a text with its history to the reclaimer, which frees them later
+void reclaimText(t_text *, t_history *);
+
+// waitReclaimer wait until every text given to the reclaimer is freed
+void waitReclaimer();
+
+// startReclaimer start the thread freeing texts
+void startReclaimer();
+
+// runReclaimer free the texts given to the reclaimer
+void *runReclaimer(void *);
+
 // printText print text from start to end
 void printText(t_text *, int, int);
 
-// changeText modify text from start with data and length given
-t_text changeText(t_text *, t_text, int);
+// printRanges print a large part of text split between threads, in order
+void printRanges(t_text *, int, int);
+
+// formatRange format the lines of a range in its buffer
+void *formatRange(void *);
+
+// changeText modify text from start with data given
+void changeText(t_text *, t_lines, int);
 
 // deleteText delete text from start to end given
 void deleteText(t_text *, t_command *);
 
-// readAndOverwriteText overwrite text while reading previous data
-t_text readAndOverwriteText(t_text *, t_text, int, int);
+// PIPELINE
+
+// startPipeline start the parse and render stages
+void startPipeline(t_pipeline *, t_input *);
+
+// stopPipeline wait for the outputs to be rendered and print the depths of the queues
+void stopPipeline(t_pipeline *);
+
+// runParseStage read commands into the queue of the execute stage until quit
+void *runParseStage(void *);
+
+// runRenderStage print the outputs of the execute stage until it stops
+void *runRenderStage(void *);
+
+// renderLater give a print or a fingerprint of the current version to the render stage
+void renderLater(t_pipeline *, t_command *, t_text *, t_history *);
+
+// createQueue create an empty queue of the given size
+void createQueue(t_stageQueue *, int);
+
+// pushQueue add an item, waiting while the queue is full
+void pushQueue(t_stageQueue *, void *);
+
+// popQueue take the oldest item, waiting while the queue is empty
+void *popQueue(t_stageQueue *);
+
+// printQueueStats print on stderr the depths a queue went through
+void printQueueStats(char *, t_stageQueue *);
+
+#ifdef LATENCY
+// LATENCY
+
+// recordLatency count the time taken by a command in the histogram of its type
+void recordLatency(char, long);
+
+// getLatencyBucket return the bucket of a latency
+int getLatencyBucket(long);
+
+// getBucketLatency return the highest latency counted in a bucket
+long getBucketLatency(int);
+
+// getPercentile return the latency under which the given share of a histogram is
+long getPercentile(t_histogram *, double);
+
+// printLatencies print on stderr a summary of the histogram of every command type
+void printLatencies();
+
+// requestLatencies ask the main loop for a summary of the histograms
+void requestLatencies(int);
+#endif
+
+// TRACE
+
+// startTrace record events until exit, then write them to the given file
+void startTrace(char *);
+
+// traceEvent add an event to the buffer of this thread
+void traceEvent(const char *, char, long);
+
+// writeTrace write the events of every thread in chrome trace format
+void writeTrace();
 
-// appendText add new text to the end
-void appendText(t_text *, t_text, int);
+// getCommandName return the name of a command type
+const char *getCommandName(char);
 
-// getTextBuffersRequired get buffers required for a text with length given
-int getTextBuffersRequired(int);
+// MEMORY
 
-// checkAndReallocText check if text needs reallocation
-void checkAndReallocText(t_text *, int);
+// countMemory add the given bytes to a category, negative when they are freed
+void countMemory(t_memoryCategory, long);
 
-// shiftAndReadText shift text from start to end given while reading previous data
-t_text shiftAndReadText(t_text *, int, int);
+// updateCounter add the given bytes to a counter and update its peak
+void updateCounter(t_memoryCounter *, long);
+
+// printMemory print on stderr the bytes in use by every category
+void printMemory();
+
+// requestMemory ask for a memory report after the command being executed
+void requestMemory(int);
+
+// WORK
+
+// recordWork count the work of a command from the nodes and copies the store had before it and the versions it added
+void recordWork(t_command *, t_store *, long, long, int);
+
+// printWork print on stderr the work of every command type and its ratio to the lines edited
+void printWork();
+
+// PERF
+
+// openPerf open the counters of this thread, and enable them if any is available
+void openPerf();
+
+// readPerf read every counter available
+t_boolean readPerf(unsigned long long *);
+
+// countPhase add the counters since the end of the previous phase to a phase of a command type
+void countPhase(char, t_phase);
+
+// printPerf print on stderr the counters of every command type and phase, per command
+void printPerf();
+
+// LINE TREE
+
+// createStore create a new store with only the empty tree
+t_store *createStore();
+
+// getNode return the node with the given index
+t_node *getNode(t_store *, int);
+
+// createNode create a new node with the given line
+int createNode(t_store *, char *);
+
+// copyNode create a copy of the given node
+int copyNode(t_store *, int);
+
+// getLine return the line of a node
+char *getLine(t_node *);
+
+// getTreeSize return the number of lines in a tree
+int getTreeSize(t_store *, int);
+
+// updateNode update size of a node from its children
+void updateNode(t_store *, int);
+
+// getFingerprint return the fingerprint of the lines of a tree
+unsigned long long getFingerprint(t_store *, int);
+
+// getPower return the fingerprint base raised to the given exponent
+unsigned long long getPower(t_store *, int);
+
+// hashLine return the fingerprint of a single line
+unsigned long long hashLine(char *);
+
+// multiplyModulo multiply two fingerprints modulo the fingerprint prime
+unsigned long long multiplyModulo(unsigned long long, unsigned long long);
+
+// splitTree split a tree after the first given lines without changing it
+void splitTree(t_store *, int, int, int *, int *);
+
+// mergeTrees return a tree with lines of the first tree and then the second
+int mergeTrees(t_store *, int, int);
+
+// buildTree build a tree with the given lines
+int buildTree(t_store *, t_lines);
+
+// printNodes print lines of a tree from start to end
+void printNodes(t_store *, int, int, int);
 
 // UTILITIES
 
-// readLine read a line from stdin
-char *readLine();
+// readLine read a line from input (stdin when NULL)
+char *readLine(t_input *);
+
+// readInput read the whole stdin in memory
+void readInput(t_input *);
+
+// mapInput map a whole file as input
+t_boolean mapInput(char *, t_input *);
+
+// createBuffer create an empty buffer
+void createBuffer(t_buffer *);
+
+// appendBuffer add bytes at the end of a buffer
+void appendBuffer(t_buffer *, char *, long);
+
+// parseOptions read command line options
+t_boolean parseOptions(int, char *[], t_options *);
 
 // printLine print a line to stdout
 void printLine(char *);
 
-// swapText swap text struct
-void swapText(t_text *, t_text *);
-
-// getEmptyTextStruct return an empty text struct
-t_text getEmptyTextStruct();
+// getEmptyLinesStruct return an empty lines struct
+t_lines getEmptyLinesStruct();
 
 // freeCommand free all area allocated for a command
 void freeCommand(t_command **);
 
+// getTypeIndex return the index of a command type in COMMAND_TYPES, the last one for other types
+int getTypeIndex(char);
+
 /* --------------------------
  * ---------- MAIN ----------
  * --------------------------
  */
 
-int main() {
+int main(int argc, char *argv[]) {
     t_text text;
     t_history history;
     t_command *command;
+    t_options options;
+    t_input input;
+    t_input *source = NULL;
+    t_journal journal;
+    t_snapshot *snapshot;
+    long journalOffset = 0;
+    pid_t checkpoint = 0;
+    t_pipeline pipeline;
+    char type;
+    t_command executed;
+    long numNodes;
+    long numCopies;
+    int numVersions;
+#ifdef LATENCY
+    long started;
+
+    signal(SIGUSR1, requestLatencies);
+#endif
+
+    if (parseOptions(argc, argv, &options) == false) {
+        fprintf(stderr, "usage: %s [--offline] [--pipeline] [--lookahead N] [--print-threads N] [--trace FILE] [--memory] [--work] [--perf] [--snapshot FILE [--snapshot-fork]] [--restore FILE] [--journal FILE [--journal-commands N] [--journal-interval MS]]\n", argv[0]);
+        fprintf(stderr, "       %s --replay JOURNAL [--replay-index FILE] [--replay-interval N] [--seek N]\n", argv[0]);
+        fprintf(stderr, "       %s --server SOCKET [--threads N] [--readers N] [--lookahead N]\n", argv[0]);
+        fprintf(stderr, "       %s --ring FILE [--ring-size N] [--lookahead N]\n", argv[0]);
+        fprintf(stderr, "       %s --batch LIST [--threads N]\n", argv[0]);
+        return 1;
+    }
+    printThreads = options.printThreads;
+    if (options.trace != NULL) {
+        startTrace(options.trace);
+    }
+    if (options.memory == true) {
+        memoryEnabled = true;
+        signal(SIGUSR2, requestMemory);
+        atexit(printMemory);
+    }
+    if (options.work == true) {
+        atexit(printWork);
+    }
+    if (options.perf == true) {
+        openPerf();
+    }
 
-    createText(&text);
-    createHistory(&history);
+    // every line of the list is a session of its own, read from a file
+    if (options.batch != NULL) {
+        return runBatch(&options);
+    }
+
+    // client on the same host writes commands to shared memory instead of stdin
+    if (options.ring != NULL) {
+        if (runRing(&options) != 0) {
+            fprintf(stderr, "cannot create ring %s\n", options.ring);
+            return 1;
+        }
+        return 0;
+    }
+
+    // server runs a session for each client instead of reading stdin
+    if (options.server != NULL) {
+        if (runServer(&options) != 0) {
+            fprintf(stderr, "cannot listen on %s\n", options.server);
+            return 1;
+        }
+        return 0;
+    }
+
+    // replay tool reads a journal, not commands from stdin
+    if (options.replay != NULL) {
+        return replaySession(&options);
+    }
+
+    if (options.restore != NULL) {
+        snapshot = restoreSession(options.restore, &text, &history);
+        if (snapshot == NULL) {
+            fprintf(stderr, "cannot restore snapshot %s\n", options.restore);
+            return 1;
+        }
+        journalOffset = snapshot->journalOffset;
+    } else {
+        createText(&text);
+        createHistory(&history);
+    }
+
+    // session of a previous run is restored from its journal
+    if (options.journal != NULL && openJournal(&journal, &options, &text, &history, journalOffset) == false) {
+        fprintf(stderr, "cannot open journal %s\n", options.journal);
+        return 1;
+    }
+
+    // edits wait at most lookahead commands for a print
+    history.maxLazyCommands = options.lookahead;
+
+    // whole input is known ahead: edits nobody prints are never built
+    if (options.offline == true) {
+        readInput(&input);
+        source = &input;
+        history.maxLazyCommands = INT_MAX;
+    }
 
     /*
         Execution process:
@@ -183,13 +1228,99 @@ int main() {
         3. update history
     */
 
-    command = readCommand();
+    // reading and printing run on threads of their own, this one only executes
+    if (options.pipeline == true) {
+        startPipeline(&pipeline, source);
+    }
+
+    command = options.pipeline == true ? popQueue(&pipeline.commands) : readCommand(source);
+    PHASE(command->type, PARSE_PHASE);
 
     while (command->type != 'q') {
-        executeCommand(command, &text, &history);
-        updateHistory(&history, command);
+        // save needs the files of the session, it does not change text or history
+        if (command->type == 's' && options.snapshot != NULL) {
+            TRACE("snapshot", 'B', history.numVersions);
+            if (options.journal != NULL && (journalOffset = drainJournal(&journal)) < 0) {
+                fprintf(stderr, "cannot write journal %s\n", options.journal);
+                return 1;
+            }
+            // checkpoints are written one at a time
+            checkpoint = waitCheckpoint(checkpoint, options.snapshot, true);
+            if (options.snapshotFork == true) {
+                checkpoint = startCheckpoint(options.snapshot, &text, &history, journalOffset);
+            }
+            if (checkpoint <= 0 && saveSession(options.snapshot, &text, &history, journalOffset, NULL) == false) {
+                fprintf(stderr, "cannot save snapshot %s\n", options.snapshot);
+            }
+            TRACE("snapshot", 'E', 0);
+        }
+        if (checkpoint > 0) {
+            checkpoint = waitCheckpoint(checkpoint, options.snapshot, false);
+        }
+        // commands cannot be executed once they are not durable any more
+        if (options.journal != NULL && journalCommand(&journal, command) == false) {
+            fprintf(stderr, "cannot write journal %s\n", options.journal);
+            return 1;
+        }
+        // journal and snapshots are not part of any phase
+        PHASE(command->type, NUM_PHASES);
+        // command is freed by updateHistory
+        type = command->type;
+        executed = *command;
+        numNodes = text.store->numNodes;
+        numCopies = text.store->numCopies;
+        numVersions = history.numVersions;
+        TRACE(getCommandName(type), 'B', command->start);
+#ifdef LATENCY
+        started = getTimeNanos();
+#endif
+        if (options.pipeline == true && (command->type == 'p' || command->type == 'h')) {
+            renderLater(&pipeline, command, &text, &history);
+            PHASE(type, EXECUTE_PHASE);
+        } else if (perf.enabled == true && (command->type == 'p' || command->type == 'h')) {
+            // version is built apart, so that the print phase only formats lines
+            loadVersion(&history, &text);
+            PHASE(type, EXECUTE_PHASE);
+            executeCommand(command, &text, &history);
+            PHASE(type, PRINT_PHASE);
+        } else {
+            executeCommand(command, &text, &history);
+            PHASE(type, EXECUTE_PHASE);
+        }
+        updateHistory(&history, command, &text);
+        PHASE(type, UPDATE_PHASE);
+        TRACE(getCommandName(type), 'E', 0);
+        recordWork(&executed, text.store, numNodes, numCopies, history.numVersions - numVersions);
+        if (memoryRequested == 1) {
+            memoryRequested = 0;
+            printMemory();
+        }
+#ifdef LATENCY
+        recordLatency(type, getTimeNanos() - started);
+        if (latenciesRequested == 1) {
+            latenciesRequested = 0;
+            printLatencies();
+        }
+#endif
+
+        command = options.pipeline == true ? popQueue(&pipeline.commands) : readCommand(source);
+        PHASE(command->type, PARSE_PHASE);
+    }
+
+    if (options.pipeline == true) {
+        stopPipeline(&pipeline);
+    }
 
-        command = readCommand();
+    if (options.journal != NULL && closeJournal(&journal) == false) {
+        fprintf(stderr, "cannot write journal %s\n", options.journal);
+        return 1;
+    }
+    waitCheckpoint(checkpoint, options.snapshot, true);
+#ifdef LATENCY
+    printLatencies();
+#endif
+    if (perf.enabled == true) {
+        printPerf();
     }
 
     return 0;
@@ -200,37 +1331,37 @@ int main() {
  * ----------------------------------
  */
 
-// readCommand read a command from stdin and return it
-t_command *readCommand() {
+// readCommand read a command from input (stdin when NULL) and return it
+t_command *readCommand(t_input *input) {
     t_command *command;
     char *line;
 
     command = malloc(sizeof(t_command));
+    COUNT_MEMORY(COMMAND_MEMORY, sizeof(t_command));
 
-    line = readLine();
+    line = readLine(input);
     // 1. Read type
     command->type = getCommandType(line);
 
     // 2. Read interval
-    // undo and redo do not have end
+    // quit, fingerprint and save have no interval, undo, redo and checkout do not have end
+    command->start = 0;
     command->end = 0;
     if (command->type == 'c' || command->type == 'd' || command->type == 'p')
         readCommandStartAndEnd(command, line);
-    if (command->type == 'u' || command->type == 'r')
+    if (command->type == 'u' || command->type == 'r' || command->type == 'v')
         command->start = readCommandStart(*command, line);
 
     // 3. Read data
     if (command->type == 'c')
-        command->data = readCommandData(*command);
+        command->data = readCommandData(*command, input);
     else
-        command->data = getEmptyTextStruct();
+        command->data = getEmptyLinesStruct();
 
     // clear read line
     free(line);
-    // initialize prevData
-    command->prevData = getEmptyTextStruct();
     // initialize values
-    command->deleteWorks = true;
+    command->lazy = false;
     return command;
 }
 
@@ -241,10 +1372,11 @@ int getCommandType(char *line) {
 }
 
 // readCommand read command data
-t_text readCommandData(t_command command) {
+t_lines readCommandData(t_command command, t_input *input) {
 
     char *line;
-    t_text data;
+    t_lines data;
+    long size = 0;
 
     // start cannot be under 0
     if (command.start <= 0) {
@@ -256,14 +1388,17 @@ t_text readCommandData(t_command command) {
 
     // allocate numLines strings
     data.lines = malloc(sizeof(char *) * data.numLines + 1);
+    COUNT_MEMORY(COMMAND_MEMORY, sizeof(char *) * data.numLines + 1);
     // read lines
     for (int i = 0; i < data.numLines; i++) {
-        line = readLine();
+        line = readLine(input);
         data.lines[i] = line;
+        size += strlen(line) + 1;
     }
+    COUNT_MEMORY(LINE_MEMORY, size);
 
     // read last line with dot
-    line = readLine();
+    line = readLine(input);
     free(line);
 
     #ifdef DEBUG
@@ -335,23 +1470,15 @@ void readCommandStartAndEnd(t_command *command, char *line) {
 
 // executeCommand execute the given command by call relative function
 void executeCommand(t_command *command, t_text *text, t_history *history) {
-    if (history->timeTravelMode == true && command->type != 'r' && command->type != 'u') {
-        if (history->commandsToTravel < 0) {
-            backToThePast(history, text);
-        } else if (history->commandsToTravel > 0) {
-            backToTheFuture(history, text);
-        }
-        // otherwise nothing to do
-    }
     switch (command->type) {
         case 'p':
+            // only prints need the text of current version
+            loadVersion(history, text);
             printCommand(command, text);
             break;
         case 'c':
-            changeCommand(command, text);
-            break;
         case 'd':
-            deleteCommand(command, text);
+            editCommand(command, text, history);
             break;
         case 'u':
             undoCommand(command, text, history);
@@ -359,6 +1486,13 @@ void executeCommand(t_command *command, t_text *text, t_history *history) {
         case 'r':
             redoCommand(command, text, history);
             break;
+        case 'v':
+            checkoutCommand(command, text, history);
+            break;
+        case 'h':
+            loadVersion(history, text);
+            fingerprintCommand(text);
+            break;
     }
 }
 
@@ -385,6 +1519,14 @@ void printCommand(t_command *command, t_text *text) {
     }
 }
 
+// fingerprintCommand print the fingerprint of the current text
+void fingerprintCommand(t_text *text) {
+    char fingerprint[MAX_LINE_LENGTH];
+
+    sprintf(fingerprint, "%016llx", getFingerprint(text->store, text->root));
+    printLine(fingerprint);
+}
+
 // changeCommand execute a change command with data given
 void changeCommand(t_command *command, t_text *text) {
     // start cannot be equal or lower 0
@@ -392,14 +1534,13 @@ void changeCommand(t_command *command, t_text *text) {
         command->start = 1;
     }
 
-    command->prevData = changeText(text, command->data, command->start);
+    changeText(text, command->data, command->start);
 }
 
 // deleteCommand execute a delete command with data given
 void deleteCommand(t_command *command, t_text *text) {
     // start cannot be greater than num lines
     if(command -> start > text -> numLines) {
-        command->deleteWorks = false;
         return;
     }
     // start cannot be equal or lower 0
@@ -413,15 +1554,32 @@ void deleteCommand(t_command *command, t_text *text) {
     deleteText(text, command);
 }
 
-// undoCommand prepare an undo command for next editing of text and history
+// editCommand execute an edit command now or leave it for the next print
+void editCommand(t_command *command, t_text *text, t_history *history) {
+    // edits are built only if a print needs them
+    if (history->numLazyCommands < history->maxLazyCommands) {
+        command->lazy = true;
+        history->numLazyCommands++;
+        return;
+    }
+
+    loadVersion(history, text);
+    if (command->type == 'c') {
+        changeCommand(command, text);
+    } else {
+        deleteCommand(command, text);
+    }
+}
+
+// undoCommand move current version back to one of its ancestors
 void undoCommand(t_command *command, t_text *text, t_history *history) {
+    t_version *current = &history->versions[history->currentVersion];
+
     // cannot revert more commands than available
     if (command->start > history->numPastCommands) {
         command->start = history->numPastCommands;
     }
-    // set number for revert
-    // undo is negative
-    history->commandsToTravel -= command->start;
+    history->currentVersion = getAncestor(history, history->currentVersion, current->depth - command->start);
     // modify stack counters
     history->numPastCommands -= command->start;
     history->numFutureCommands += command->start;
@@ -429,17 +1587,18 @@ void undoCommand(t_command *command, t_text *text, t_history *history) {
     history->timeTravelMode = true;
 }
 
-// redoCommand prepare a redo command for next editing of text and history
+// redoCommand move current version forward to the last version
 void redoCommand(t_command *command, t_text *text, t_history *history) {
+    t_version *current = &history->versions[history->currentVersion];
+
     // only when time travel mode is active redo can be done
     if (history->timeTravelMode == true) {
         // cannot revert more commands than available
         if (command->start > history->numFutureCommands) {
             command->start = history->numFutureCommands;
         }
-        // set number for revert
-        // redo is positive
-        history->commandsToTravel += command->start;
+        // current version is always an ancestor of the last one
+        history->currentVersion = getAncestor(history, history->lastVersion, current->depth + command->start);
         // modify stack counters
         history->numPastCommands += command->start;
         history->numFutureCommands -= command->start;
@@ -447,26 +1606,58 @@ void redoCommand(t_command *command, t_text *text, t_history *history) {
     return;
 }
 
+// checkoutCommand make the given version the current one
+void checkoutCommand(t_command *command, t_text *text, t_history *history) {
+    // unknown versions are ignored
+    if (command->start < 0 || command->start >= history->numVersions) {
+        return;
+    }
+    // path from the empty version becomes the past, there is no future
+    history->currentVersion = command->start;
+    history->lastVersion = command->start;
+    history->numPastCommands = history->versions[command->start].depth;
+    history->numFutureCommands = 0;
+    history->timeTravelMode = false;
+}
+
 /* ------------------------------------
  * ---------- UPDATE HISTORY ----------
  * ------------------------------------
  */
 
-// createHistory create a new empty history struct
+// createHistory create a new history with only the empty version
 void createHistory(t_history *history) {
-    history->commandsToTravel = 0;
+    t_version *empty;
+
+    history->versionsAllocated = HISTORY_BUFFER_SIZE;
+    history->versions = malloc(sizeof(t_version) * history->versionsAllocated);
+    COUNT_MEMORY(VERSION_MEMORY, sizeof(t_version) * history->versionsAllocated);
+    history->versionsMapped = false;
+    // version 0 is the empty text and it is its own parent
+    empty = &history->versions[0];
+    empty->parent = 0;
+    empty->jump = 0;
+    empty->depth = 0;
+    empty->root = EMPTY_TREE;
+    empty->numLines = 0;
+    empty->command = NULL;
+    history->numVersions = 1;
+
+    history->currentVersion = 0;
+    history->lastVersion = 0;
+    history->textVersion = 0;
     history->timeTravelMode = false;
-    history->futureCommands = NULL;
-    history->pastCommands = NULL;
     history->numPastCommands = 0;
     history->numFutureCommands = 0;
+    history->numLazyCommands = 0;
+    history->maxLazyCommands = 0;
     return;
 }
 
 // updateHistory check for update in history after a command execution
-void updateHistory(t_history *history, t_command *command) {
+void updateHistory(t_history *history, t_command *command, t_text *text) {
     checkForPastChanges(history, command);
-    addNewEventToHistory(history, command);
+    addNewEventToHistory(history, command, text);
     return;
 }
 
@@ -485,29 +1676,32 @@ void checkForPastChanges(t_history *history, t_command *command) {
     return;
 }
 
-// forgetFuture remove all commands stored in future stack
+// forgetFuture make current version the last one reachable with redo
 void forgetFuture(t_history *history) {
-    t_command *command, *app;
-    command = history->futureCommands;
-    while (command != NULL) {
-        app = command;
-        command = command->next;
-        freeCommand(&app);
-    }
-    history->futureCommands = NULL;
+    TRACE("forgetFuture", 'i', history->numFutureCommands);
+    // versions of the old future stay in the tree for checkout
+    history->lastVersion = history->currentVersion;
     history->numFutureCommands = 0;
     return;
 }
 
-// addNewEventToHistory add a new command in history
-void addNewEventToHistory(t_history *history, t_command *command) {
-    t_command *newHead;
+// addNewEventToHistory add a new version in history
+void addNewEventToHistory(t_history *history, t_command *command, t_text *text) {
+    int version;
 
     // only change and delete commands should be saved
     if (command->type == 'c' || command->type == 'd') {
-        newHead = command;
-        newHead->next = history->pastCommands;
-        history->pastCommands = newHead;
+        version = addVersion(history, history->currentVersion, command);
+        // text already holds the new version
+        if (command->lazy == false) {
+            history->versions[version].root = text->root;
+            history->versions[version].numLines = text->numLines;
+            history->versions[version].command = NULL;
+            history->textVersion = version;
+            freeCommand(&command);
+        }
+        history->currentVersion = version;
+        history->lastVersion = version;
         history->numPastCommands++;
     } else {
         freeCommand(&command);
@@ -515,90 +1709,2639 @@ void addNewEventToHistory(t_history *history, t_command *command) {
     return;
 }
 
-// backToThePast revert commands to go back to the past
-void backToThePast(t_history *history, t_text *text) {
-    t_command *command, *app;
-    char **strApp;
-
-    history->commandsToTravel *= -1;
-
-    // undo commands in stack
-    for (int i = 0; i < history->commandsToTravel; i++) {
-        command = history->pastCommands;
+// addVersion add a child of the given version and return its id
+int addVersion(t_history *history, int parent, t_command *command) {
+    t_version *version;
+    t_version *parentVersion;
+    t_version *jump;
+
+    if (history->numVersions == history->versionsAllocated) {
+        history->versionsAllocated *= 2;
+        TRACE("growVersions", 'i', history->versionsAllocated);
+        if (history->versionsMapped == true) {
+            // versions of a snapshot are moved to memory only when they grow
+            version = malloc(sizeof(t_version) * history->versionsAllocated);
+            COUNT_MEMORY(VERSION_MEMORY, sizeof(t_version) * history->versionsAllocated);
+            memcpy(version, history->versions, sizeof(t_version) * history->numVersions);
+            history->versions = version;
+            history->versionsMapped = false;
+        } else {
+            history->versions = realloc(history->versions, sizeof(t_version) * history->versionsAllocated);
+            COUNT_MEMORY(VERSION_MEMORY, sizeof(t_version) * (history->versionsAllocated / 2));
+        }
+    }
 
-        revertCommand(command, text, true);
+    version = &history->versions[history->numVersions];
+    parentVersion = &history->versions[parent];
+    jump = &history->versions[parentVersion->jump];
 
-        moveEventBetweenStack(command, &history->pastCommands, &history->futureCommands);
+    version->parent = parent;
+    version->depth = parentVersion->depth + 1;
+    // jumps of equal length are joined, so any ancestor is O(log n) steps away
+    if (parentVersion->depth - jump->depth == jump->depth - history->versions[jump->jump].depth) {
+        version->jump = jump->jump;
+    } else {
+        version->jump = parent;
     }
+    version->root = NOT_BUILT;
+    version->numLines = 0;
+    version->command = command;
 
-    history->commandsToTravel = 0;
-    return;
+    return history->numVersions++;
 }
 
-// backToTheFuture revert commands to go back to the future
-void backToTheFuture(t_history *history, t_text *text) {
+// getAncestor return the ancestor of a version at the given depth
+int getAncestor(t_history *history, int version, int depth) {
+    t_version *versions = history->versions;
 
-    t_command *command, *app;
-
-    // redo commands in stack
-    for (int i = 0; i < history->commandsToTravel; i++) {
-        command = history->futureCommands;
+    while (versions[version].depth > depth) {
+        if (versions[versions[version].jump].depth >= depth) {
+            version = versions[version].jump;
+        } else {
+            version = versions[version].parent;
+        }
+    }
+    return version;
+}
 
-        revertCommand(command, text, false);
+// loadVersion build text of current version if needed
+void loadVersion(t_history *history, t_text *text) {
+    t_version *current;
 
-        // command go to other stack
-        moveEventBetweenStack(command, &history->futureCommands, &history->pastCommands);
+    if (history->textVersion != history->currentVersion) {
+        buildVersion(history, text->store, history->currentVersion);
+        current = &history->versions[history->currentVersion];
+        text->root = current->root;
+        text->numLines = current->numLines;
+        history->textVersion = history->currentVersion;
     }
-
-    history->commandsToTravel = 0;
-    return;
+    history->numLazyCommands = 0;
 }
 
-// revertCommand revert a command
-void revertCommand(t_command *command, t_text *text, t_boolean isUndo) {
-    // check command type
-    if (command->type == 'c') {
-        revertChange(command, text);
+// buildVersion build text of a version from its nearest built ancestor
+void buildVersion(t_history *history, t_store *store, int id) {
+    t_version *version;
+    t_text text;
+    t_delta delta;
+    int *chain;
+    int numEdits = 0;
+    int built = id;
+
+    // find nearest built ancestor
+    while (history->versions[built].root == NOT_BUILT) {
+        built = history->versions[built].parent;
+        numEdits++;
     }
-    else if (command->type == 'd') {
-        if (command->deleteWorks) {
-            revertDeleteText(text, command);
-        }
+    if (numEdits == 0) {
+        return;
     }
-    #ifdef DEBUG
-    else
-    {
-        printf("ERROR: try to time travel with a bad command\n");
+
+    TRACE("buildVersion", 'B', numEdits);
+    // edits from the built ancestor down to the version
+    chain = malloc(sizeof(int) * numEdits);
+    for (int i = numEdits - 1; i >= 0; i--) {
+        chain[i] = id;
+        id = history->versions[id].parent;
     }
-    #endif
 
-    return;
-}
+    text.store = store;
+    text.root = history->versions[built].root;
+    text.numLines = history->versions[built].numLines;
+
+    // edits are composed and applied once, lines changed many times are built once
+    createDelta(&delta, &text);
+    for (int i = 0; i < numEdits; i++) {
+        composeEdit(&delta, history->versions[chain[i]].command);
+
+        // few versions on the way are built too, so that undo near them is cheap
+        if ((i + 1) % MAX_COMPOSED_EDITS == 0 || i == numEdits - 1) {
+            applyDelta(&delta, &text);
+            version = &history->versions[chain[i]];
+            version->root = text.root;
+            version->numLines = text.numLines;
+            freeCommand(&version->command);
+            free(delta.segments);
+            createDelta(&delta, &text);
+        }
+    }
 
-// revertCommand revert a change command
-void revertChange(t_command *command, t_text *text) {
-    swapText(text, &command->prevData);
+    free(delta.segments);
+    free(chain);
+    TRACE("buildVersion", 'E', 0);
 }
 
-// revertCommand revert a delete command
-void revertDeleteText(t_text *text, t_command *command) {
-    swapText(text, &command->prevData);
-}
+/* -----------------------------------
+ * ---------- COMPOSE EDITS ----------
+ * -----------------------------------
+ */
 
-// moveEventBetweenStack move a command between first stack to second stack
-void moveEventBetweenStack(t_command *command, t_command **old, t_command **new) {
-    t_command *app;
-    // command go to other stack, so set next as head of commands stack
-    app = command->next;
-    if (*new == NULL) {
-        command->next = NULL;
-    } else {
-        command->next = *new;
+// createDelta create a delta that leaves the given text unchanged
+void createDelta(t_delta *delta, t_text *text) {
+    delta->segmentsAllocated = SEGMENT_BUFFER_SIZE;
+    delta->segments = malloc(sizeof(t_segment) * delta->segmentsAllocated);
+    delta->numSegments = 0;
+    delta->numLines = text->numLines;
+
+    if (text->numLines > 0) {
+        delta->segments[0].root = text->root;
+        delta->segments[0].start = 0;
+        delta->segments[0].numLines = text->numLines;
+        delta->segments[0].lines = NULL;
+        delta->numSegments = 1;
+    }
+}
+
+// composeEdit add an edit command at the end of a delta
+void composeEdit(t_delta *delta, t_command *command) {
+    t_segment data;
+    int start = command->start;
+    int end;
+
+    // same limits of change and delete commands
+    if (start <= 0) {
+        start = 1;
+    }
+    if (command->type == 'c') {
+        // lines after the end of text are appended
+        if (start > delta->numLines) {
+            start = delta->numLines + 1;
+        }
+        end = start + command->data.numLines - 1;
+        if (end > delta->numLines) {
+            end = delta->numLines;
+        }
+        data.root = EMPTY_TREE;
+        data.start = 0;
+        data.numLines = command->data.numLines;
+        data.lines = command->data.lines;
+        replaceSegments(delta, start - 1, end, &data);
+    } else {
+        if (command->start > delta->numLines) {
+            return;
+        }
+        end = command->end;
+        if (end > delta->numLines) {
+            end = delta->numLines;
+        }
+        replaceSegments(delta, start - 1, end, NULL);
+    }
+}
+
+// splitSegment split segments at the given line and return first segment after it
+int splitSegment(t_delta *delta, int position) {
+    t_segment *segment;
+    int i = 0;
+
+    while (i < delta->numSegments && position >= delta->segments[i].numLines) {
+        position -= delta->segments[i].numLines;
+        i++;
+    }
+    // position is already between two segments
+    if (i == delta->numSegments || position == 0) {
+        return i;
+    }
+
+    if (delta->numSegments == delta->segmentsAllocated) {
+        delta->segmentsAllocated *= 2;
+        delta->segments = realloc(delta->segments, sizeof(t_segment) * delta->segmentsAllocated);
+    }
+    memmove(&delta->segments[i + 1], &delta->segments[i], sizeof(t_segment) * (delta->numSegments - i));
+    delta->numSegments++;
+
+    // second half starts after the first position lines
+    segment = &delta->segments[i];
+    segment->numLines = position;
+    segment++;
+    segment->numLines -= position;
+    if (segment->lines != NULL) {
+        segment->lines += position;
+    } else {
+        segment->start += position;
+    }
+
+    return i + 1;
+}
+
+// replaceSegments replace lines from start to end with the given segment
+void replaceSegments(t_delta *delta, int start, int end, t_segment *data) {
+    int first, last, numAdded;
+
+    first = splitSegment(delta, start);
+    last = splitSegment(delta, end);
+    numAdded = data != NULL ? 1 : 0;
+
+    if (delta->numSegments + numAdded > delta->segmentsAllocated) {
+        delta->segmentsAllocated *= 2;
+        delta->segments = realloc(delta->segments, sizeof(t_segment) * delta->segmentsAllocated);
+    }
+    memmove(&delta->segments[first + numAdded], &delta->segments[last], sizeof(t_segment) * (delta->numSegments - last));
+    delta->numSegments += first + numAdded - last;
+    if (data != NULL) {
+        delta->segments[first] = *data;
+        delta->numLines += data->numLines;
+    }
+    delta->numLines -= end - start;
+}
+
+// applyDelta build text after a delta with a single edit of the tree
+void applyDelta(t_delta *delta, t_text *text) {
+    t_segment *segment;
+    t_lines data;
+    int root = EMPTY_TREE;
+    int left, middle, right;
+
+    for (int i = 0; i < delta->numSegments; i++) {
+        segment = &delta->segments[i];
+        if (segment->lines != NULL) {
+            data.lines = segment->lines;
+            data.numLines = segment->numLines;
+            middle = buildTree(text->store, data);
+        } else {
+            // lines kept from the old text are shared
+            splitTree(text->store, segment->root, segment->start, &left, &right);
+            splitTree(text->store, right, segment->numLines, &middle, &right);
+        }
+        root = mergeTrees(text->store, root, middle);
+    }
+
+    text->root = root;
+    text->numLines = delta->numLines;
+}
+
+/* -----------------------------
+ * ---------- JOURNAL ----------
+ * -----------------------------
+ */
+
+// openJournal replay commands of the journal and open it to add new ones
+t_boolean openJournal(t_journal *journal, t_options *options, t_text *text, t_history *history, long start) {
+    t_input input;
+    long size;
+    int maxLazyCommands = history->maxLazyCommands;
+    pthread_condattr_t attributes;
+
+    journal->file = open(options->journal, O_RDWR | O_CREAT, 0644);
+    if (journal->file < 0) {
+        return false;
+    }
+
+    // whole journal after start is read at once and parsed from memory
+    size = lseek(journal->file, 0, SEEK_END);
+    if (start > size) {
+        start = size;
+    }
+    input.size = size - start;
+    input.buffer = malloc(sizeof(char) * (input.size + 1));
+    input.offset = 0;
+    if (pread(journal->file, input.buffer, input.size, start) != input.size) {
+        free(input.buffer);
+        close(journal->file);
+        return false;
+    }
+
+    // journal has no print, every edit waits for the first print of the session
+    history->maxLazyCommands = INT_MAX;
+    size = replayJournal(&input, text, history);
+    history->maxLazyCommands = maxLazyCommands;
+    free(input.buffer);
+
+    // a record cut by a crash is dropped, new records follow the last valid one
+    if (size < input.size && ftruncate(journal->file, start + size) != 0) {
+        close(journal->file);
+        return false;
+    }
+    lseek(journal->file, start + size, SEEK_SET);
+
+    journal->allocated = JOURNAL_BUFFER_SIZE;
+    journal->buffer = malloc(sizeof(char) * journal->allocated);
+    journal->size = 0;
+    journal->numPendingCommands = 0;
+    journal->syncCommands = options->journalCommands;
+    journal->syncInterval = options->journalInterval;
+    journal->lastSync = getTimeMillis();
+
+    journal->syncAllocated = JOURNAL_BUFFER_SIZE;
+    journal->syncBuffer = malloc(sizeof(char) * journal->syncAllocated);
+    journal->syncSize = 0;
+    journal->syncPending = false;
+    journal->closing = false;
+    journal->failed = false;
+    pthread_mutex_init(&journal->lock, NULL);
+    // writer waits for the interval on the same clock as lastSync
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&journal->changed, &attributes);
+    pthread_condattr_destroy(&attributes);
+    // commands are not blocked while a group is written
+    if (pthread_create(&journal->writer, NULL, writeJournal, journal) != 0) {
+        close(journal->file);
+        return false;
+    }
+
+    return true;
+}
+
+// replayJournal execute commands of the journal and return size of valid records
+long replayJournal(t_input *input, t_text *text, t_history *history) {
+    t_command *command;
+
+    while ((command = readRecord(input)) != NULL) {
+        executeCommand(command, text, history);
+        updateHistory(history, command, text);
+    }
+
+    return input->offset;
+}
+
+// readRecord read the command of the next record, NULL when it is missing or broken
+t_command *readRecord(t_input *input) {
+    t_record record;
+    t_input payload;
+
+    if (input->offset + (long) sizeof(t_record) > input->size) {
+        return NULL;
+    }
+    memcpy(&record, input->buffer + input->offset, sizeof(t_record));
+    if (record.size > input->size - input->offset - sizeof(t_record)) {
+        return NULL;
+    }
+    payload.buffer = input->buffer + input->offset + sizeof(t_record);
+    payload.size = record.size;
+    payload.offset = 0;
+    if (getChecksum(payload.buffer, payload.size) != record.checksum) {
+        return NULL;
+    }
+
+    input->offset += sizeof(t_record) + record.size;
+    return readCommand(&payload);
+}
+
+// journalCommand add a command to the journal before it is executed, false when the journal failed
+t_boolean journalCommand(t_journal *journal, t_command *command) {
+    t_record record;
+    char *payload;
+    long length;
+    long lineLength;
+    t_boolean committed = true;
+
+    // prints, fingerprints and saves do not change the session
+    if (command->type == 'p' || command->type == 'h' || command->type == 's') {
+        return true;
+    }
+
+    // writer may take the buffer when the interval runs out
+    pthread_mutex_lock(&journal->lock);
+    if (journal->failed == true) {
+        pthread_mutex_unlock(&journal->lock);
+        return false;
+    }
+
+    // header line and final dot always fit, data lines are checked one by one
+    checkJournalBuffer(journal, sizeof(t_record) + 2 * MAX_LINE_LENGTH);
+    payload = journal->buffer + journal->size + sizeof(t_record);
+    length = writeNumber(payload, command->start);
+    if (command->type == 'c' || command->type == 'd') {
+        payload[length] = ',';
+        length++;
+        length += writeNumber(payload + length, command->end);
+    }
+    payload[length] = command->type;
+    payload[length + 1] = '\n';
+    length += 2;
+    if (command->type == 'c') {
+        for (int i = 0; i < command->data.numLines; i++) {
+            lineLength = strlen(command->data.lines[i]);
+            checkJournalBuffer(journal, sizeof(t_record) + length + lineLength + 3);
+            payload = journal->buffer + journal->size + sizeof(t_record);
+            memcpy(payload + length, command->data.lines[i], lineLength);
+            payload[length + lineLength] = '\n';
+            length += lineLength + 1;
+        }
+        payload[length] = '.';
+        payload[length + 1] = '\n';
+        length += 2;
+    }
+
+    // checksum is computed by the writer thread
+    record.size = length;
+    record.checksum = 0;
+    memcpy(journal->buffer + journal->size, &record, sizeof(t_record));
+    journal->size += sizeof(t_record) + length;
+    journal->numPendingCommands++;
+
+    // commands are synced in groups, only one group is written at a time and the next one grows meanwhile
+    if (journal->syncPending == false && isGroupDue(journal, getTimeMillis()) == true) {
+        committed = commitJournal(journal);
+    } else if (journal->numPendingCommands == 1) {
+        // an idle writer starts waiting for the interval of the new group
+        pthread_cond_broadcast(&journal->changed);
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return committed;
+}
+
+// writeNumber write a number in the given buffer and return its length
+int writeNumber(char *buffer, int number) {
+    char digits[16];
+    int length = 0;
+    int numDigits = 0;
+    unsigned int value = number;
+
+    if (number < 0) {
+        buffer[length] = '-';
+        length++;
+        value = -(unsigned int) number;
+    }
+    do {
+        digits[numDigits] = '0' + value % 10;
+        numDigits++;
+        value /= 10;
+    } while (value > 0);
+    while (numDigits > 0) {
+        numDigits--;
+        buffer[length] = digits[numDigits];
+        length++;
+    }
+    return length;
+}
+
+// checkJournalBuffer make room in the journal buffer for the given bytes
+void checkJournalBuffer(t_journal *journal, long size) {
+    if (journal->size + size > journal->allocated) {
+        while (journal->size + size > journal->allocated) {
+            journal->allocated *= 2;
+        }
+        journal->buffer = realloc(journal->buffer, sizeof(char) * journal->allocated);
+    }
+}
+
+// commitJournal give records of the current group to the writer thread, false when the journal failed
+t_boolean commitJournal(t_journal *journal) {
+    char *buffer;
+    long allocated;
+
+    // called with the lock held and no group pending
+    if (journal->failed == true) {
+        return false;
+    }
+    buffer = journal->syncBuffer;
+    allocated = journal->syncAllocated;
+    journal->syncBuffer = journal->buffer;
+    journal->syncAllocated = journal->allocated;
+    journal->syncSize = journal->size;
+    journal->syncPending = true;
+    pthread_cond_broadcast(&journal->changed);
+
+    journal->buffer = buffer;
+    journal->allocated = allocated;
+    journal->size = 0;
+    journal->numPendingCommands = 0;
+    journal->lastSync = getTimeMillis();
+    return true;
+}
+
+// isGroupDue tell if the current group has enough commands or waited long enough
+t_boolean isGroupDue(t_journal *journal, long now) {
+    if (journal->numPendingCommands == 0) {
+        return false;
+    }
+    return journal->numPendingCommands >= journal->syncCommands || now - journal->lastSync >= journal->syncInterval;
+}
+
+// writeJournal write groups of records to the journal file and sync it
+void *writeJournal(void *argument) {
+    t_journal *journal = argument;
+    t_record record;
+    long written, bytes;
+    long start;
+    long now;
+    t_boolean synced;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&journal->lock);
+    while (true) {
+        // an idle session still syncs its last commands once the interval runs out
+        while (journal->syncPending == false && journal->closing == false) {
+            now = getTimeMillis();
+            if (isGroupDue(journal, now) == true) {
+                commitJournal(journal);
+            } else if (journal->numPendingCommands > 0) {
+                clock_gettime(CLOCK_MONOTONIC, &deadline);
+                deadline.tv_nsec += (journal->lastSync + journal->syncInterval - now) * 1000000;
+                deadline.tv_sec += deadline.tv_nsec / 1000000000;
+                deadline.tv_nsec %= 1000000000;
+                pthread_cond_timedwait(&journal->changed, &journal->lock, &deadline);
+            } else {
+                pthread_cond_wait(&journal->changed, &journal->lock);
+            }
+        }
+        if (journal->syncPending == false) {
+            break;
+        }
+        pthread_mutex_unlock(&journal->lock);
+
+        TRACE("syncJournal", 'B', journal->syncSize);
+        // group is owned by this thread until it is synced
+        for (long offset = 0; offset < journal->syncSize; offset += sizeof(t_record) + record.size) {
+            memcpy(&record, journal->syncBuffer + offset, sizeof(t_record));
+            record.checksum = getChecksum(journal->syncBuffer + offset + sizeof(t_record), record.size);
+            memcpy(journal->syncBuffer + offset, &record, sizeof(t_record));
+        }
+        start = lseek(journal->file, 0, SEEK_CUR);
+        written = 0;
+        synced = true;
+        while (written < journal->syncSize) {
+            bytes = write(journal->file, journal->syncBuffer + written, journal->syncSize - written);
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes < 0) {
+                synced = false;
+                break;
+            }
+            written += bytes;
+        }
+        if (synced == true && fdatasync(journal->file) != 0) {
+            synced = false;
+        }
+        TRACE("syncJournal", 'E', 0);
+
+        pthread_mutex_lock(&journal->lock);
+        journal->syncPending = false;
+        pthread_cond_broadcast(&journal->changed);
+        if (synced == false) {
+            // a torn group is removed if possible, so that a restart finds only whole records
+            perror("journal");
+            if (ftruncate(journal->file, start) == 0) {
+                lseek(journal->file, start, SEEK_SET);
+            }
+            journal->failed = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    return NULL;
+}
+
+// drainJournal wait until every command is synced and return journal size, -1 when the journal failed
+long drainJournal(t_journal *journal) {
+    t_boolean failed;
+
+    pthread_mutex_lock(&journal->lock);
+    while (journal->syncPending == true) {
+        pthread_cond_wait(&journal->changed, &journal->lock);
+    }
+    if (journal->numPendingCommands > 0 && commitJournal(journal) == true) {
+        while (journal->syncPending == true) {
+            pthread_cond_wait(&journal->changed, &journal->lock);
+        }
+    }
+    failed = journal->failed;
+    pthread_mutex_unlock(&journal->lock);
+    if (failed == true) {
+        return -1;
+    }
+
+    // writer is idle, file offset is the end of the last record
+    return lseek(journal->file, 0, SEEK_CUR);
+}
+
+// closeJournal write pending records and close the journal, false when they were not all synced
+t_boolean closeJournal(t_journal *journal) {
+    t_boolean synced;
+
+    // writer ends after the last group is synced
+    pthread_mutex_lock(&journal->lock);
+    while (journal->syncPending == true) {
+        pthread_cond_wait(&journal->changed, &journal->lock);
+    }
+    if (journal->numPendingCommands > 0) {
+        commitJournal(journal);
+    }
+    journal->closing = true;
+    pthread_cond_broadcast(&journal->changed);
+    pthread_mutex_unlock(&journal->lock);
+    pthread_join(journal->writer, NULL);
+    synced = journal->failed == false;
+
+    close(journal->file);
+    free(journal->buffer);
+    free(journal->syncBuffer);
+    return synced;
+}
+
+// getChecksum return checksum of the given bytes
+unsigned int getChecksum(char *bytes, long size) {
+    unsigned long long checksum = 14695981039346656037ull;
+    unsigned long long other = 1099511628211ull;
+    unsigned long long words[2];
+    long i = 0;
+
+    // sixteen bytes at a time on two independent sums, then the remaining ones
+    for (; i + 16 <= size; i += 16) {
+        memcpy(words, bytes + i, sizeof(words));
+        checksum = ((checksum << 5 | checksum >> 59) ^ words[0]) * 0x100000001b3ull;
+        other = ((other << 5 | other >> 59) ^ words[1]) * 0x100000001b3ull;
+    }
+    for (; i < size; i++) {
+        checksum = (checksum ^ (unsigned char) bytes[i]) * 0x100000001b3ull;
+    }
+    checksum ^= other * 0x9e3779b97f4a7c15ull;
+    return (unsigned int) (checksum ^ checksum >> 32);
+}
+
+// getTimeMillis return a monotonic time in milliseconds
+long getTimeMillis() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// getTimeNanos return a monotonic time in nanoseconds
+long getTimeNanos() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/* ------------------------------
+ * ---------- SNAPSHOT ----------
+ * ------------------------------
+ */
+
+// saveSession write text, history and points of an index to a snapshot file
+t_boolean saveSession(char *path, t_text *text, t_history *history, long journalOffset, t_replayIndex *index) {
+    t_snapshot header;
+    t_store *store = text->store;
+    t_savedLine *savedLines;
+    t_savedLine *saved;
+    t_node node;
+    char *temporaryPath;
+    FILE *file;
+    long numSavedLines;
+    long linesSize;
+    long position;
+
+    // lazy versions are built, snapshot has only trees
+    for (int i = 1; i < history->numVersions; i++) {
+        if (history->versions[i].root == NOT_BUILT) {
+            buildVersion(history, store, i);
+        }
+    }
+
+    // lines shared by many nodes are saved once
+    numSavedLines = 1;
+    while (numSavedLines < 2L * store->numNodes) {
+        numSavedLines *= 2;
+    }
+    savedLines = calloc(numSavedLines, sizeof(t_savedLine));
+    linesSize = saveLines(store, savedLines, numSavedLines);
+
+    memset(&header, 0, sizeof(t_snapshot));
+    strcpy(header.magic, SNAPSHOT_MAGIC);
+    header.nodeSize = sizeof(t_node);
+    header.versionSize = sizeof(t_version);
+    header.numNodes = store->numNodes;
+    header.seed = store->seed;
+    header.numVersions = history->numVersions;
+    header.currentVersion = history->currentVersion;
+    header.lastVersion = history->lastVersion;
+    header.textVersion = history->textVersion;
+    header.numPastCommands = history->numPastCommands;
+    header.numFutureCommands = history->numFutureCommands;
+    header.timeTravelMode = history->timeTravelMode;
+    header.journalOffset = journalOffset;
+    // only nodes in use are saved, whole chunks are mapped as they are
+    header.nodesOffset = SNAPSHOT_ALIGNMENT;
+    header.versionsOffset = header.nodesOffset + (long) store->numNodes * sizeof(t_node);
+    header.linesOffset = header.versionsOffset + (long) history->numVersions * sizeof(t_version);
+    header.pointsOffset = header.linesOffset + linesSize;
+    if (index != NULL) {
+        header.pointsOffset = (header.pointsOffset + sizeof(long) - 1) / sizeof(long) * sizeof(long);
+        header.numPoints = index->numPoints;
+        header.lastRecordOffset = index->lastRecordOffset;
+        header.lastRecordChecksum = index->lastRecordChecksum;
+    }
+    header.size = header.pointsOffset + (long) header.numPoints * sizeof(t_replayPoint);
+
+    // snapshot is replaced only when it is complete
+    temporaryPath = malloc(sizeof(char) * (strlen(path) + 5));
+    sprintf(temporaryPath, "%s.tmp", path);
+    file = fopen(temporaryPath, "wb");
+    if (file == NULL) {
+        free(savedLines);
+        free(temporaryPath);
+        return false;
+    }
+
+    fwrite(&header, sizeof(t_snapshot), 1, file);
+
+    fseek(file, header.nodesOffset, SEEK_SET);
+    for (int i = 0; i < store->numNodes; i++) {
+        node = *getNode(store, i);
+        if (i != EMPTY_TREE) {
+            saved = findSavedLine(savedLines, numSavedLines, getLine(getNode(store, i)));
+            position = header.nodesOffset + (long) i * sizeof(t_node);
+            node.line = header.linesOffset + saved->offset - position;
+        }
+        fwrite(&node, sizeof(t_node), 1, file);
+    }
+
+    fseek(file, header.versionsOffset, SEEK_SET);
+    fwrite(history->versions, sizeof(t_version), history->numVersions, file);
+
+    // lines in the order of their offsets
+    position = 0;
+    for (int i = 1; i < store->numNodes; i++) {
+        saved = findSavedLine(savedLines, numSavedLines, getLine(getNode(store, i)));
+        if (saved->offset == position) {
+            fwrite(saved->line, sizeof(char), strlen(saved->line) + 1, file);
+            position += strlen(saved->line) + 1;
+        }
+    }
+
+    if (header.numPoints > 0) {
+        fseek(file, header.pointsOffset, SEEK_SET);
+        fwrite(index->points, sizeof(t_replayPoint), header.numPoints, file);
+    }
+
+    free(savedLines);
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0 || ferror(file)) {
+        fclose(file);
+        free(temporaryPath);
+        return false;
+    }
+    fclose(file);
+    if (rename(temporaryPath, path) != 0) {
+        free(temporaryPath);
+        return false;
+    }
+    free(temporaryPath);
+
+    return true;
+}
+
+// saveLines assign an offset to every different line of the store and return their size
+long saveLines(t_store *store, t_savedLine *savedLines, long numSavedLines) {
+    t_savedLine *saved;
+    char *line;
+    long size = 0;
+
+    for (int i = 1; i < store->numNodes; i++) {
+        line = getLine(getNode(store, i));
+        saved = findSavedLine(savedLines, numSavedLines, line);
+        if (saved->line == NULL) {
+            saved->line = line;
+            saved->offset = size;
+            size += strlen(line) + 1;
+        }
+    }
+
+    return size;
+}
+
+// findSavedLine return the entry of a line in the table of saved lines
+t_savedLine *findSavedLine(t_savedLine *savedLines, long numSavedLines, char *line) {
+    unsigned long long hash = (unsigned long long) line * 0x9e3779b97f4a7c15ull;
+    long i = (hash >> 20) & (numSavedLines - 1);
+
+    // empty entry is where the line has to be added
+    while (savedLines[i].line != NULL && savedLines[i].line != line) {
+        i = (i + 1) & (numSavedLines - 1);
+    }
+    return &savedLines[i];
+}
+
+// startCheckpoint save the session from a child process and return its id
+pid_t startCheckpoint(char *path, t_text *text, t_history *history, long journalOffset) {
+    struct stat status;
+    long start = getTimeMillis();
+    pid_t child;
+
+    // child saves its copy of the session while the editor goes on
+    child = fork();
+    if (child != 0) {
+        return child;
+    }
+
+    if (saveSession(path, text, history, journalOffset, NULL) == false) {
+        _exit(1);
+    }
+    stat(path, &status);
+    fprintf(stderr, "checkpoint %s: %d versions, %d nodes, %ld bytes in %ld ms\n", path, history->numVersions, text->store->numNodes, (long) status.st_size, getTimeMillis() - start);
+    // output buffered by the editor must not be written twice
+    _exit(0);
+}
+
+// waitCheckpoint check if the checkpoint is finished and return its id while it runs
+pid_t waitCheckpoint(pid_t checkpoint, char *path, t_boolean block) {
+    int status;
+
+    if (checkpoint <= 0) {
+        return 0;
+    }
+    if (waitpid(checkpoint, &status, block == true ? 0 : WNOHANG) == 0) {
+        return checkpoint;
+    }
+    if (WIFEXITED(status) == false || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "cannot save snapshot %s\n", path);
+    }
+    return 0;
+}
+
+// restoreSession map a snapshot file as text and history and return its header
+t_snapshot *restoreSession(char *path, t_text *text, t_history *history) {
+    t_snapshot *header;
+    t_store *store;
+    struct stat status;
+    char *snapshot;
+    t_node *nodes;
+    long numChunks;
+    long numLastNodes;
+    int file;
+
+    file = open(path, O_RDONLY);
+    if (file < 0) {
+        return NULL;
+    }
+    if (fstat(file, &status) != 0 || status.st_size < (long) sizeof(t_snapshot)) {
+        close(file);
+        return NULL;
+    }
+    // private mapping, nothing done on the session changes the file
+    snapshot = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    close(file);
+    if (snapshot == MAP_FAILED) {
+        return NULL;
+    }
+
+    header = (t_snapshot *) snapshot;
+    if (strcmp(header->magic, SNAPSHOT_MAGIC) != 0 || header->nodeSize != sizeof(t_node) || header->versionSize != sizeof(t_version) || header->size != status.st_size) {
+        munmap(snapshot, status.st_size);
+        return NULL;
+    }
+
+    // nodes and versions are used in place, nothing is read line by line
+    store = calloc(1, sizeof(t_store));
+    COUNT_MEMORY(NODE_MEMORY, sizeof(t_store));
+    numChunks = header->numNodes / NODE_CHUNK_SIZE;
+    for (long i = 0; i < numChunks; i++) {
+        store->chunks[i] = (t_node *) (snapshot + header->nodesOffset) + i * NODE_CHUNK_SIZE;
+    }
+    // last chunk is saved only up to its last node, it is copied where new nodes can follow
+    numLastNodes = header->numNodes % NODE_CHUNK_SIZE;
+    if (numLastNodes > 0) {
+        nodes = (t_node *) (snapshot + header->nodesOffset) + numChunks * NODE_CHUNK_SIZE;
+        store->chunks[numChunks] = malloc(sizeof(t_node) * NODE_CHUNK_SIZE);
+        COUNT_MEMORY(NODE_MEMORY, sizeof(t_node) * NODE_CHUNK_SIZE);
+        memcpy(store->chunks[numChunks], nodes, sizeof(t_node) * numLastNodes);
+        // lines are addressed from the node, so they are moved with it
+        for (long i = 0; i < numLastNodes; i++) {
+            store->chunks[numChunks][i].line += (char *) &nodes[i] - (char *) &store->chunks[numChunks][i];
+        }
+    }
+    store->numNodes = header->numNodes;
+    store->seed = header->seed;
+
+    createHistory(history);
+    COUNT_MEMORY(VERSION_MEMORY, -(long) sizeof(t_version) * history->versionsAllocated);
+    free(history->versions);
+    history->versions = (t_version *) (snapshot + header->versionsOffset);
+    history->numVersions = header->numVersions;
+    history->versionsAllocated = header->numVersions;
+    history->versionsMapped = true;
+    history->currentVersion = header->currentVersion;
+    history->lastVersion = header->lastVersion;
+    history->textVersion = header->textVersion;
+    history->numPastCommands = header->numPastCommands;
+    history->numFutureCommands = header->numFutureCommands;
+    history->timeTravelMode = header->timeTravelMode;
+
+    text->store = store;
+    text->root = history->versions[history->textVersion].root;
+    text->numLines = history->versions[history->textVersion].numLines;
+
+    return header;
+}
+
+/* ----------------------------------
+ * ---------- REPLAY INDEX ----------
+ * ----------------------------------
+ */
+
+// replaySession index a journal and print text after one of its commands
+int replaySession(t_options *options) {
+    t_text text;
+    t_history history;
+    t_replayIndex index;
+    t_input journal;
+    t_command *command;
+    char *indexPath = options->replayIndex;
+    t_record record;
+    long indexed;
+    long numCommands;
+    long replayed;
+    long recordOffset;
+    long start = getTimeMillis();
+
+    if (mapInput(options->replay, &journal) == false) {
+        fprintf(stderr, "cannot read journal %s\n", options->replay);
+        return 1;
+    }
+    // index is kept next to the journal unless told otherwise
+    if (indexPath == NULL) {
+        indexPath = malloc(sizeof(char) * (strlen(options->replay) + 7));
+        sprintf(indexPath, "%s.index", options->replay);
+    }
+
+    index.interval = options->replayInterval;
+    indexed = loadIndex(&index, indexPath, &journal, &text, &history);
+
+    // commands added to the journal after the index was saved are indexed now
+    history.maxLazyCommands = INT_MAX;
+    numCommands = index.points[index.numPoints - 1].command;
+    journal.offset = indexed;
+    recordOffset = indexed;
+    while ((command = readRecord(&journal)) != NULL) {
+        index.lastRecordOffset = recordOffset;
+        recordOffset = journal.offset;
+        executeCommand(command, &text, &history);
+        updateHistory(&history, command, &text);
+        numCommands++;
+        if (numCommands % index.interval == 0) {
+            addReplayPoint(&index, numCommands, journal.offset, &history);
+        }
+    }
+    if (journal.offset > indexed) {
+        // next run goes on from the end of the journal
+        if (index.points[index.numPoints - 1].command != numCommands) {
+            addReplayPoint(&index, numCommands, journal.offset, &history);
+        }
+        memcpy(&record, journal.buffer + index.lastRecordOffset, sizeof(t_record));
+        index.lastRecordChecksum = record.checksum;
+        if (saveSession(indexPath, &text, &history, journal.offset, &index) == false) {
+            fprintf(stderr, "cannot save index %s\n", indexPath);
+        } else {
+            fprintf(stderr, "index %s: %ld commands, %d points in %ld ms\n", indexPath, numCommands, index.numPoints, getTimeMillis() - start);
+        }
+    }
+
+    if (options->seek >= 0) {
+        start = getTimeMillis();
+        replayed = seekCommand(&index, &journal, options->seek, &text, &history);
+        loadVersion(&history, &text);
+        if (text.numLines > 0) {
+            printText(&text, 1, text.numLines);
+        }
+        fprintf(stderr, "seek %ld: %ld commands replayed in %ld ms\n", options->seek, replayed, getTimeMillis() - start);
+    }
+
+    return 0;
+}
+
+// loadIndex read the index of a journal and return how much of the journal it covers
+long loadIndex(t_replayIndex *index, char *path, t_input *journal, t_text *text, t_history *history) {
+    t_snapshot *snapshot;
+
+    snapshot = restoreSession(path, text, history);
+    // an index of another journal, or of one rewritten since, is rebuilt
+    if (snapshot != NULL && (snapshot->numPoints == 0 || isIndexOf(snapshot, journal) == false)) {
+        COUNT_MEMORY(NODE_MEMORY, -(long) sizeof(t_store));
+        free(text->store);
+        munmap(snapshot, snapshot->size);
+        snapshot = NULL;
+    }
+
+    index->numPoints = 0;
+    index->pointsAllocated = HISTORY_BUFFER_SIZE;
+    if (snapshot == NULL) {
+        createText(text);
+        createHistory(history);
+        index->points = malloc(sizeof(t_replayPoint) * index->pointsAllocated);
+        addReplayPoint(index, 0, 0, history);
+        return 0;
+    }
+
+    while (index->pointsAllocated < snapshot->numPoints) {
+        index->pointsAllocated *= 2;
+    }
+    index->points = malloc(sizeof(t_replayPoint) * index->pointsAllocated);
+    memcpy(index->points, (char *) snapshot + snapshot->pointsOffset, sizeof(t_replayPoint) * snapshot->numPoints);
+    index->numPoints = snapshot->numPoints;
+    index->lastRecordOffset = snapshot->lastRecordOffset;
+    index->lastRecordChecksum = snapshot->lastRecordChecksum;
+    return snapshot->journalOffset;
+}
+
+// isIndexOf tell if an index was made for the given journal
+t_boolean isIndexOf(t_snapshot *snapshot, t_input *journal) {
+    t_record record;
+
+    // journal still has what was indexed, up to a last record with the same checksum
+    if (snapshot->journalOffset > journal->size || snapshot->lastRecordOffset + (long) sizeof(t_record) > snapshot->journalOffset) {
+        return false;
+    }
+    memcpy(&record, journal->buffer + snapshot->lastRecordOffset, sizeof(t_record));
+    return snapshot->lastRecordOffset + (long) sizeof(t_record) + record.size == snapshot->journalOffset && record.checksum == snapshot->lastRecordChecksum;
+}
+
+// addReplayPoint add a point with the current history to the index
+void addReplayPoint(t_replayIndex *index, long command, long journalOffset, t_history *history) {
+    t_replayPoint *point;
+
+    if (index->numPoints == index->pointsAllocated) {
+        index->pointsAllocated *= 2;
+        index->points = realloc(index->points, sizeof(t_replayPoint) * index->pointsAllocated);
+    }
+
+    point = &index->points[index->numPoints];
+    point->command = command;
+    point->journalOffset = journalOffset;
+    point->numVersions = history->numVersions;
+    point->currentVersion = history->currentVersion;
+    point->lastVersion = history->lastVersion;
+    point->numPastCommands = history->numPastCommands;
+    point->numFutureCommands = history->numFutureCommands;
+    point->timeTravelMode = history->timeTravelMode;
+    index->numPoints++;
+}
+
+// seekCommand bring text and history after the given command and return commands replayed
+long seekCommand(t_replayIndex *index, t_input *journal, long target, t_text *text, t_history *history) {
+    t_replayPoint *point;
+    t_command *command;
+    int low = 0;
+    int high = index->numPoints - 1;
+    int middle;
+    long replayed = 0;
+
+    // last point not after the target
+    while (low < high) {
+        middle = (low + high + 1) / 2;
+        if (index->points[middle].command <= target) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    point = &index->points[low];
+
+    // versions are persistent, history at the point is its versions and counters
+    history->numVersions = point->numVersions;
+    history->currentVersion = point->currentVersion;
+    history->lastVersion = point->lastVersion;
+    history->numPastCommands = point->numPastCommands;
+    history->numFutureCommands = point->numFutureCommands;
+    history->timeTravelMode = point->timeTravelMode;
+    history->numLazyCommands = 0;
+    // every version of the index is built before it is saved
+    history->textVersion = point->currentVersion;
+    text->root = history->versions[point->currentVersion].root;
+    text->numLines = history->versions[point->currentVersion].numLines;
+
+    journal->offset = point->journalOffset;
+    while (point->command + replayed < target && (command = readRecord(journal)) != NULL) {
+        executeCommand(command, text, history);
+        updateHistory(history, command, text);
+        replayed++;
+    }
+
+    return replayed;
+}
+
+/* ----------------------------
+ * ---------- SERVER ----------
+ * ----------------------------
+ */
+
+// runServer run sessions of the clients of a unix socket until the server is killed
+int runServer(t_options *options) {
+    t_server server;
+    struct sockaddr_un address;
+    struct epoll_event event;
+    struct epoll_event events[SERVER_EVENTS];
+    t_session *session;
+    t_boolean reading;
+    int numEvents;
+    sigset_t signals;
+
+    server.socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    memset(&address, 0, sizeof(struct sockaddr_un));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, options->server, sizeof(address.sun_path) - 1);
+    // socket file of a previous server is replaced
+    unlink(options->server);
+    if (server.socket < 0 || bind(server.socket, (struct sockaddr *) &address, sizeof(struct sockaddr_un)) != 0 || listen(server.socket, SOMAXCONN) != 0) {
+        return 1;
+    }
+
+    server.poll = epoll_create1(EPOLL_CLOEXEC);
+    // listening socket is the only event without a session
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(server.poll, EPOLL_CTL_ADD, server.socket, &event);
+
+    // server runs until killed, when tracing it leaves on SIGTERM so that the trace is written
+    if (traceEnabled == true) {
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+        event.events = EPOLLIN;
+        event.data.ptr = &server;
+        epoll_ctl(server.poll, EPOLL_CTL_ADD, signalfd(-1, &signals, SFD_CLOEXEC), &event);
+    }
+
+    server.lookahead = options->lookahead;
+    server.stopping = false;
+    server.nextWorker = 0;
+    server.numQueued = 0;
+    server.numSleeping = 0;
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+    server.numWorkers = options->threads > 0 ? options->threads : sysconf(_SC_NPROCESSORS_ONLN);
+    server.workers = malloc(sizeof(t_worker) * server.numWorkers);
+    for (int i = 0; i < server.numWorkers; i++) {
+        server.workers[i].server = &server;
+        server.workers[i].id = i;
+        server.workers[i].seed = 2463534242u + i;
+        server.workers[i].deque.allocated = DEQUE_SIZE;
+        server.workers[i].deque.sessions = malloc(sizeof(t_session *) * DEQUE_SIZE);
+        server.workers[i].deque.first = 0;
+        server.workers[i].deque.size = 0;
+        pthread_mutex_init(&server.workers[i].deque.lock, NULL);
+    }
+    for (int i = 0; i < server.numWorkers; i++) {
+        pthread_create(&server.workers[i].thread, NULL, runWorker, &server.workers[i]);
+    }
+
+    server.firstPrint = NULL;
+    server.lastPrint = NULL;
+    pthread_mutex_init(&server.printsLock, NULL);
+    pthread_cond_init(&server.printsReady, NULL);
+    server.numReaders = options->readers;
+    server.readers = malloc(sizeof(pthread_t) * (server.numReaders + 1));
+    for (int i = 0; i < server.numReaders; i++) {
+        pthread_create(&server.readers[i], NULL, runReader, &server);
+    }
+
+    // this thread only accepts clients and reads their commands
+    while (true) {
+        numEvents = epoll_wait(server.poll, events, SERVER_EVENTS, -1);
+        // a signal interrupts the wait
+        if (memoryRequested == 1) {
+            memoryRequested = 0;
+            printMemory();
+        }
+        for (int i = 0; i < numEvents; i++) {
+            if (events[i].data.ptr == NULL) {
+                acceptClient(&server);
+            } else if (events[i].data.ptr == &server) {
+                stopServer(&server);
+                return 0;
+            } else {
+                // only this thread ends reading, a session that stopped reading is watched for output only
+                session = events[i].data.ptr;
+                reading = session->reading;
+                if ((events[i].events & EPOLLOUT) != 0 || reading == false) {
+                    writeClient(session);
+                }
+                if (reading == true && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0) {
+                    readClient(&server, session);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+// stopServer let the threads of the server finish what they run and wait for them
+void stopServer(t_server *server) {
+    pthread_mutex_lock(&server->lock);
+    __atomic_store_n(&server->stopping, true, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+    for (int i = 0; i < server->numWorkers; i++) {
+        pthread_join(server->workers[i].thread, NULL);
+    }
+
+    // prints published and not rendered yet are dropped
+    pthread_mutex_lock(&server->printsLock);
+    pthread_cond_broadcast(&server->printsReady);
+    pthread_mutex_unlock(&server->printsLock);
+    for (int i = 0; i < server->numReaders; i++) {
+        pthread_join(server->readers[i], NULL);
+    }
+}
+
+// acceptClient open a new session for a client waiting on the socket
+void acceptClient(t_server *server) {
+    t_session *session;
+    struct epoll_event event;
+    int client;
+
+    client = accept(server->socket, NULL, NULL);
+    if (client < 0) {
+        return;
+    }
+    // no thread waits on a client, output it cannot take yet is kept in its session
+    fcntl(client, F_SETFL, O_NONBLOCK);
+
+    session = malloc(sizeof(t_session));
+    session->socket = client;
+    session->poll = server->poll;
+    createText(&session->text);
+    createHistory(&session->history);
+    session->history.maxLazyCommands = server->lookahead;
+    createBuffer(&session->input);
+    createBuffer(&session->output);
+    session->scheduled = false;
+    session->finished = false;
+    session->closed = false;
+    // new sessions are spread over the workers
+    session->worker = server->nextWorker;
+    server->nextWorker = (server->nextWorker + 1) % server->numWorkers;
+    pthread_mutex_init(&session->lock, NULL);
+    session->firstOutput = NULL;
+    session->lastOutput = NULL;
+    createBuffer(&session->unsent);
+    session->reading = true;
+    session->writing = false;
+    session->quit = false;
+    session->pins = 1;
+    pthread_mutex_init(&session->outputLock, NULL);
+
+    event.events = EPOLLIN;
+    event.data.ptr = session;
+    epoll_ctl(server->poll, EPOLL_CTL_ADD, client, &event);
+}
+
+// readClient add bytes sent by a client to the commands of its session
+void readClient(t_server *server, t_session *session) {
+    char buffer[INPUT_BUFFER_SIZE];
+    long size;
+
+    size = read(session->socket, buffer, INPUT_BUFFER_SIZE);
+    if (size < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+
+    pthread_mutex_lock(&session->lock);
+    if (size > 0) {
+        appendBuffer(&session->input, buffer, size);
+    } else {
+        // session is not read by this thread anymore, the worker frees it once its output is sent
+        pthread_mutex_lock(&session->outputLock);
+        session->reading = false;
+        watchClient(session, true);
+        pthread_mutex_unlock(&session->outputLock);
+        session->closed = true;
+    }
+    scheduleSession(server, session);
+    pthread_mutex_unlock(&session->lock);
+}
+
+// writeClient send output left unsent when the socket of a client is writable again
+void writeClient(t_session *session) {
+    t_buffer unsent;
+    t_boolean released = false;
+
+    pthread_mutex_lock(&session->outputLock);
+    if (session->writing == false) {
+        pthread_mutex_unlock(&session->outputLock);
+        return;
+    }
+    unsent = session->unsent;
+    createBuffer(&session->unsent);
+    sendBuffer(session, &unsent);
+    free(unsent.data);
+
+    // only this thread stops watching for room, so no event is left for a session that may be freed
+    if (session->unsent.size == 0) {
+        session->writing = false;
+        watchClient(session, true);
+        released = true;
+    }
+    finishOutput(session);
+    pthread_mutex_unlock(&session->outputLock);
+
+    if (released == true) {
+        unpinSession(session);
+    }
+}
+
+// watchClient update the events the socket of a session is watched for
+void watchClient(t_session *session, t_boolean watched) {
+    struct epoll_event event;
+
+    // called with the output lock held
+    event.events = (session->reading == true ? EPOLLIN : 0) | (session->writing == true ? EPOLLOUT : 0);
+    event.data.ptr = session;
+    if (event.events == 0) {
+        epoll_ctl(session->poll, EPOLL_CTL_DEL, session->socket, NULL);
+    } else {
+        epoll_ctl(session->poll, watched == true ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, session->socket, &event);
+    }
+}
+
+// scheduleSession queue a session on its worker unless it is queued or running
+void scheduleSession(t_server *server, t_session *session) {
+    // a session is run by one worker at a time, so its commands stay in order
+    if (session->scheduled == true) {
+        return;
+    }
+    session->scheduled = true;
+    queueSession(server, session->worker, session);
+}
+
+// queueSession add a session to a worker and wake a waiting worker
+void queueSession(t_server *server, int id, t_session *session) {
+    t_deque *deque = &server->workers[id].deque;
+    t_session **sessions;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->size == deque->allocated) {
+        sessions = malloc(sizeof(t_session *) * deque->allocated * 2);
+        for (int i = 0; i < deque->size; i++) {
+            sessions[i] = deque->sessions[(deque->first + i) % deque->allocated];
+        }
+        free(deque->sessions);
+        deque->sessions = sessions;
+        deque->first = 0;
+        deque->allocated *= 2;
+    }
+    deque->sessions[(deque->first + deque->size) % deque->allocated] = session;
+    deque->size++;
+    pthread_mutex_unlock(&deque->lock);
+
+    // a worker going to sleep counts itself before it checks the queued sessions
+    __atomic_add_fetch(&server->numQueued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&server->numSleeping, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&server->lock);
+        pthread_cond_signal(&server->ready);
+        pthread_mutex_unlock(&server->lock);
+    }
+}
+
+// runWorker run sessions of its deque and steal sessions of other workers when it is empty
+void *runWorker(void *argument) {
+    t_worker *worker = argument;
+    t_server *server = worker->server;
+    t_session *session;
+
+    while (__atomic_load_n(&server->stopping, __ATOMIC_SEQ_CST) == false) {
+        session = takeSession(&worker->deque, true);
+        if (session == NULL) {
+            session = stealSession(worker);
+        }
+        if (session != NULL) {
+            __atomic_sub_fetch(&server->numQueued, 1, __ATOMIC_SEQ_CST);
+            runSession(worker, session);
+            continue;
+        }
+
+        // nothing to run anywhere, wait for a new session
+        pthread_mutex_lock(&server->lock);
+        __atomic_add_fetch(&server->numSleeping, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&server->numQueued, __ATOMIC_SEQ_CST) == 0 && __atomic_load_n(&server->stopping, __ATOMIC_SEQ_CST) == false) {
+            pthread_cond_wait(&server->ready, &server->lock);
+        }
+        __atomic_sub_fetch(&server->numSleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    return NULL;
+}
+
+// takeSession remove a session from a deque, the oldest or the newest one, NULL when it is empty
+t_session *takeSession(t_deque *deque, t_boolean oldest) {
+    t_session *session = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->size > 0) {
+        if (oldest == true) {
+            session = deque->sessions[deque->first];
+            deque->first = (deque->first + 1) % deque->allocated;
+        } else {
+            session = deque->sessions[(deque->first + deque->size - 1) % deque->allocated];
+        }
+        deque->size--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return session;
+}
+
+// stealSession take the newest session of another worker
+t_session *stealSession(t_worker *worker) {
+    t_server *server = worker->server;
+    t_session *session;
+    int victim;
+
+    // xorshift, workers do not all steal from the same one
+    worker->seed ^= worker->seed << 13;
+    worker->seed ^= worker->seed >> 17;
+    worker->seed ^= worker->seed << 5;
+
+    victim = worker->seed % server->numWorkers;
+    for (int i = 0; i < server->numWorkers; i++) {
+        if (victim != worker->id) {
+            session = takeSession(&server->workers[victim].deque, false);
+            if (session != NULL) {
+                return session;
+            }
+        }
+        victim = (victim + 1) % server->numWorkers;
+    }
+    return NULL;
+}
+
+// runSession execute a batch of commands of a session and send what they print
+void runSession(t_worker *worker, t_session *session) {
+    t_input input;
+    t_command *command;
+    int numCommands = 0;
+    long size;
+    char type;
+
+    pthread_mutex_lock(&session->lock);
+    // only whole commands are taken, the rest waits for more bytes
+    input.size = 0;
+    while (session->finished == false && numCommands < SESSION_BATCH_COMMANDS && (size = getCommandSize(session->input.data + input.size, session->input.size - input.size)) > 0) {
+        input.size += size;
+        numCommands++;
+    }
+    if (input.size == 0) {
+        if (session->closed == true) {
+            pthread_mutex_unlock(&session->lock);
+            unpinSession(session);
+            return;
+        }
+        session->scheduled = false;
+        pthread_mutex_unlock(&session->lock);
+        return;
+    }
+    input.buffer = malloc(sizeof(char) * input.size);
+    memcpy(input.buffer, session->input.data, input.size);
+    session->input.size -= input.size;
+    memmove(session->input.data, session->input.data + input.size, session->input.size);
+    pthread_mutex_unlock(&session->lock);
+
+    // prints of the session go to its client
+    printBuffer = &session->output;
+    input.offset = 0;
+    while (input.offset < input.size) {
+        command = readCommand(&input);
+        if (command->type == 'q') {
+            freeCommand(&command);
+            pthread_mutex_lock(&session->lock);
+            session->finished = true;
+            pthread_mutex_unlock(&session->lock);
+            break;
+        }
+        type = command->type;
+        TRACE(getCommandName(type), 'B', command->start);
+        if (command->type == 'p' && worker->server->numReaders > 0) {
+            // version is immutable once built, a reader prints it while edits go on
+            loadVersion(&session->history, &session->text);
+            queuePrinted(session);
+            publishPrint(worker->server, session, command);
+        } else {
+            executeCommand(command, &session->text, &session->history);
+        }
+        updateHistory(&session->history, command, &session->text);
+        TRACE(getCommandName(type), 'E', 0);
+    }
+    printBuffer = NULL;
+    free(input.buffer);
+
+    queuePrinted(session);
+    if (session->finished == true) {
+        pthread_mutex_lock(&session->outputLock);
+        session->quit = true;
+        pthread_mutex_unlock(&session->outputLock);
+    }
+    flushOutput(session);
+
+    // session goes back behind the others of the worker, a busy one cannot keep it
+    pthread_mutex_lock(&session->lock);
+    session->worker = worker->id;
+    if (session->closed == true || (session->finished == false && getCommandSize(session->input.data, session->input.size) > 0)) {
+        queueSession(worker->server, worker->id, session);
+    } else {
+        session->scheduled = false;
+    }
+    pthread_mutex_unlock(&session->lock);
+}
+
+// getCommandSize return the size of the first command of the given bytes, 0 when it is not all received
+long getCommandSize(char *buffer, long size) {
+    char *end;
+    char *comma;
+    long length;
+    int numLines;
+
+    end = memchr(buffer, '\n', size);
+    if (end == NULL) {
+        return 0;
+    }
+    length = end - buffer + 1;
+
+    // only a change has more lines, its data and the final dot
+    comma = memchr(buffer, ',', length);
+    if (length < 2 || end[-1] != 'c' || comma == NULL) {
+        return length;
+    }
+    numLines = atoi(comma + 1) - (atoi(buffer) > 0 ? atoi(buffer) : 1) + 2;
+    for (int i = 0; i < numLines; i++) {
+        end = memchr(buffer + length, '\n', size - length);
+        if (end == NULL) {
+            return 0;
+        }
+        length = end - buffer + 1;
+    }
+
+    return length;
+}
+
+// publishPrint give a print of the current version to the readers
+void publishPrint(t_server *server, t_session *session, t_command *command) {
+    t_output *output = malloc(sizeof(t_output));
+
+    output->done = false;
+    output->text = session->text;
+    output->start = command->start;
+    output->end = command->end;
+    output->session = session;
+    output->nextPrint = NULL;
+    __atomic_add_fetch(&session->pins, 1, __ATOMIC_SEQ_CST);
+    queueOutput(session, output);
+
+    pthread_mutex_lock(&server->printsLock);
+    if (server->lastPrint == NULL) {
+        server->firstPrint = output;
+    } else {
+        server->lastPrint->nextPrint = output;
+    }
+    server->lastPrint = output;
+    pthread_cond_signal(&server->printsReady);
+    pthread_mutex_unlock(&server->printsLock);
+}
+
+// runReader print published versions while their sessions go on
+void *runReader(void *argument) {
+    t_server *server = argument;
+    t_output *output;
+    t_session *session;
+    t_command command;
+
+    while (true) {
+        pthread_mutex_lock(&server->printsLock);
+        while (server->firstPrint == NULL && __atomic_load_n(&server->stopping, __ATOMIC_SEQ_CST) == false) {
+            pthread_cond_wait(&server->printsReady, &server->printsLock);
+        }
+        if (__atomic_load_n(&server->stopping, __ATOMIC_SEQ_CST) == true) {
+            pthread_mutex_unlock(&server->printsLock);
+            break;
+        }
+        output = server->firstPrint;
+        server->firstPrint = output->nextPrint;
+        if (server->firstPrint == NULL) {
+            server->lastPrint = NULL;
+        }
+        pthread_mutex_unlock(&server->printsLock);
+
+        // nodes of a built version never change, no lock is needed to read them
+        createBuffer(&output->buffer);
+        command.type = 'p';
+        command.start = output->start;
+        command.end = output->end;
+        printBuffer = &output->buffer;
+        printCommand(&command, &output->text);
+        printBuffer = NULL;
+
+        session = output->session;
+        pthread_mutex_lock(&session->outputLock);
+        output->done = true;
+        pthread_mutex_unlock(&session->outputLock);
+        flushOutput(session);
+        unpinSession(session);
+    }
+
+    return NULL;
+}
+
+// queuePrinted queue what the worker printed since the last output of the session
+void queuePrinted(t_session *session) {
+    t_output *output;
+
+    if (session->output.size == 0) {
+        return;
+    }
+    output = malloc(sizeof(t_output));
+    output->buffer.data = malloc(sizeof(char) * session->output.size);
+    memcpy(output->buffer.data, session->output.data, session->output.size);
+    output->buffer.size = session->output.size;
+    output->buffer.allocated = session->output.size;
+    output->done = true;
+    queueOutput(session, output);
+    session->output.size = 0;
+}
+
+// queueOutput add an output after the others of its session
+void queueOutput(t_session *session, t_output *output) {
+    pthread_mutex_lock(&session->outputLock);
+    output->next = NULL;
+    if (session->lastOutput == NULL) {
+        session->firstOutput = output;
+    } else {
+        session->lastOutput->next = output;
+    }
+    session->lastOutput = output;
+    pthread_mutex_unlock(&session->outputLock);
+}
+
+// flushOutput send to the client the outputs of its session that are done, in order
+void flushOutput(t_session *session) {
+    t_output *output;
+
+    // sends never wait, a slow client does not stop the session
+    pthread_mutex_lock(&session->outputLock);
+    while (session->firstOutput != NULL && session->firstOutput->done == true) {
+        output = session->firstOutput;
+        session->firstOutput = output->next;
+        sendBuffer(session, &output->buffer);
+        free(output->buffer.data);
+        free(output);
+    }
+    if (session->firstOutput == NULL) {
+        session->lastOutput = NULL;
+    }
+    finishOutput(session);
+    pthread_mutex_unlock(&session->outputLock);
+}
+
+// sendBuffer send a buffer to a client without waiting and keep what the socket cannot take
+void sendBuffer(t_session *session, t_buffer *buffer) {
+    long sent = 0;
+    long size;
+
+    // called with the output lock held, output goes after what is already unsent
+    while (session->unsent.size == 0 && sent < buffer->size) {
+        size = send(session->socket, buffer->data + sent, buffer->size - sent, MSG_NOSIGNAL);
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        // output of a client that went away is dropped
+        if (size <= 0) {
+            return;
+        }
+        sent += size;
+    }
+    if (sent < buffer->size) {
+        appendBuffer(&session->unsent, buffer->data + sent, buffer->size - sent);
+    }
+}
+
+// finishOutput watch for room while output is unsent and shut the connection down after the last output
+void finishOutput(t_session *session) {
+    t_boolean watched = session->reading == true || session->writing == true;
+
+    // called with the output lock held, the session stays until its output is sent
+    if (session->unsent.size > 0 && session->writing == false) {
+        __atomic_add_fetch(&session->pins, 1, __ATOMIC_SEQ_CST);
+        session->writing = true;
+        watchClient(session, watched);
+    }
+    // client sees the end of the output, the server sees the end of the input
+    if (session->quit == true && session->firstOutput == NULL && session->unsent.size == 0) {
+        shutdown(session->socket, SHUT_RDWR);
+    }
+}
+
+// unpinSession let a session go and free it after the last one
+void unpinSession(t_session *session) {
+    if (__atomic_sub_fetch(&session->pins, 1, __ATOMIC_SEQ_CST) == 0) {
+        closeSession(session);
+    }
+}
+
+// closeSession close the connection of a session and free its text and history
+void closeSession(t_session *session) {
+    close(session->socket);
+    reclaimText(&session->text, &session->history);
+
+    free(session->input.data);
+    free(session->output.data);
+    free(session->unsent.data);
+    pthread_mutex_destroy(&session->lock);
+    pthread_mutex_destroy(&session->outputLock);
+    free(session);
+}
+
+/* --------------------------
+ * ---------- RING ----------
+ * --------------------------
+ */
+
+// runRing run a session on the commands a client writes to a ring file, until quit
+int runRing(t_options *options) {
+    t_text text;
+    t_history history;
+    t_ringFile *ring;
+    t_input input;
+    t_command *command;
+    t_buffer output;
+    t_buffer pending;
+    char *commands;
+    char *prints;
+    unsigned int size = RING_HEADER_SIZE;
+    unsigned int head;
+    unsigned int events;
+    unsigned int available;
+    long commandSize;
+    t_boolean finished = false;
+
+    while (size < options->ringSize && size < MAX_RING_SIZE) {
+        size *= 2;
+    }
+    ring = createRingFile(options->ring, size, &commands, &prints);
+    if (ring == NULL) {
+        return 1;
+    }
+
+    createText(&text);
+    createHistory(&history);
+    history.maxLazyCommands = options->lookahead;
+    createBuffer(&output);
+    createBuffer(&pending);
+    printBuffer = &output;
+
+    while (finished == false) {
+        // commands are read where the client wrote them, only whole ones
+        events = __atomic_load_n(&ring->commands.events, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&ring->commands.head, __ATOMIC_ACQUIRE);
+        input.buffer = commands + (ring->commands.tail & (size - 1));
+        input.size = 0;
+        input.offset = 0;
+        while ((commandSize = getCommandSize(input.buffer + input.size, head - ring->commands.tail - input.size)) > 0) {
+            input.size += commandSize;
+        }
+        if (pending.size > 0 || (input.size == 0 && head - ring->commands.tail == size)) {
+            // a command larger than the ring is gathered in memory with what follows it, until that is all run
+            available = head - ring->commands.tail;
+            appendBuffer(&pending, commands + (ring->commands.tail & (size - 1)), available);
+            __atomic_store_n(&ring->commands.tail, head, __ATOMIC_SEQ_CST);
+            wakeRing(&ring->commands.tail, &ring->commands.writerWaiting);
+            input.buffer = pending.data;
+            input.size = 0;
+            while ((commandSize = getCommandSize(input.buffer + input.size, pending.size - input.size)) > 0) {
+                input.size += commandSize;
+            }
+            if (input.size == 0) {
+                if (available == 0) {
+                    waitRing(&ring->commands.events, events, &ring->commands.readerWaiting);
+                }
+                continue;
+            }
+        } else if (input.size == 0) {
+            waitRing(&ring->commands.events, events, &ring->commands.readerWaiting);
+            continue;
+        }
+
+        while (input.offset < input.size) {
+            command = readCommand(&input);
+            if (command->type == 'q') {
+                freeCommand(&command);
+                finished = true;
+                break;
+            }
+            executeCommand(command, &text, &history);
+            updateHistory(&history, command, &text);
+        }
+
+        // lines kept by the text are copies, the client can write over its commands
+        if (input.buffer == pending.data) {
+            pending.size -= input.size;
+            memmove(pending.data, pending.data + input.size, pending.size);
+        } else {
+            __atomic_store_n(&ring->commands.tail, ring->commands.tail + input.size, __ATOMIC_SEQ_CST);
+            wakeRing(&ring->commands.tail, &ring->commands.writerWaiting);
+        }
+        writeRing(&ring->prints, prints, size, output.data, output.size);
+        output.size = 0;
+    }
+
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&ring->prints.events, 1, __ATOMIC_SEQ_CST);
+    wakeRing(&ring->prints.events, &ring->prints.readerWaiting);
+    printBuffer = NULL;
+    free(pending.data);
+
+    return 0;
+}
+
+// createRingFile create a ring file for a client and map its header and rings
+t_ringFile *createRingFile(char *path, unsigned int size, char **commands, char **prints) {
+    t_ringFile *ring;
+    char *temporary;
+    int file;
+
+    // client finds the file under its name only once it is ready
+    temporary = malloc(sizeof(char) * (strlen(path) + 5));
+    sprintf(temporary, "%s.new", path);
+    file = open(temporary, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (file < 0) {
+        free(temporary);
+        return NULL;
+    }
+    if (ftruncate(file, RING_HEADER_SIZE + 2L * size) != 0) {
+        close(file);
+        unlink(temporary);
+        free(temporary);
+        return NULL;
+    }
+
+    ring = mmap(NULL, RING_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    *commands = mapRing(file, RING_HEADER_SIZE, size);
+    *prints = mapRing(file, RING_HEADER_SIZE + size, size);
+    close(file);
+    if (ring == MAP_FAILED || *commands == NULL || *prints == NULL) {
+        unlink(temporary);
+        free(temporary);
+        return NULL;
+    }
+
+    // file starts zeroed, so counters and flags are already set
+    ring->size = size;
+    memcpy(ring->magic, RING_MAGIC, sizeof(RING_MAGIC));
+    if (rename(temporary, path) != 0) {
+        unlink(temporary);
+        free(temporary);
+        return NULL;
+    }
+    free(temporary);
+
+    return ring;
+}
+
+// mapRing map the data of a ring twice in a row, so bytes across its end are contiguous
+char *mapRing(int file, long offset, unsigned int size) {
+    char *data;
+
+    data = mmap(NULL, 2L * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    if (mmap(data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, offset) == MAP_FAILED
+            || mmap(data + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, offset) == MAP_FAILED) {
+        munmap(data, 2L * size);
+        return NULL;
+    }
+
+    return data;
+}
+
+// writeRing copy bytes to a ring, waiting for the client when it is full
+void writeRing(t_ring *ring, char *data, unsigned int size, char *source, long length) {
+    unsigned int tail;
+    long space;
+    long count;
+
+    while (length > 0) {
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        space = size - (ring->head - tail);
+        if (space == 0) {
+            waitRing(&ring->tail, tail, &ring->writerWaiting);
+            continue;
+        }
+        count = length < space ? length : space;
+        memcpy(data + (ring->head & (size - 1)), source, count);
+        __atomic_store_n(&ring->head, ring->head + count, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&ring->events, 1, __ATOMIC_SEQ_CST);
+        wakeRing(&ring->events, &ring->readerWaiting);
+        source += count;
+        length -= count;
+    }
+}
+
+// waitRing sleep while a counter of a ring keeps the given value
+void waitRing(unsigned int *counter, unsigned int value, int *waiting) {
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    // counter may have changed before the other side saw the flag
+    if (__atomic_load_n(counter, __ATOMIC_SEQ_CST) == value) {
+        syscall(SYS_futex, counter, FUTEX_WAIT, value, NULL, NULL, 0);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+// wakeRing wake the other side of a ring when it sleeps on a counter
+void wakeRing(unsigned int *counter, int *waiting) {
+    // a side that does not sleep costs no system call
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST) == 1) {
+        syscall(SYS_futex, counter, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/* ---------------------------
+ * ---------- BATCH ----------
+ * ---------------------------
+ */
+
+// runBatch run the input files of a list on a pool of threads, each with its own text
+int runBatch(t_options *options) {
+    t_batch batch;
+    t_input list;
+    pthread_t *threads;
+    int numThreads;
+
+    if (mapInput(options->batch, &list) == false) {
+        fprintf(stderr, "cannot read list %s\n", options->batch);
+        return 1;
+    }
+    readJobs(&batch, &list);
+    // largest inputs go first, so a large one does not run alone at the end
+    qsort(batch.jobs, batch.numJobs, sizeof(t_job), compareJobs);
+
+    numThreads = options->threads > 0 ? options->threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads > batch.numJobs) {
+        numThreads = batch.numJobs;
+    }
+    threads = malloc(sizeof(pthread_t) * (numThreads + 1));
+    for (int i = 0; i < numThreads; i++) {
+        pthread_create(&threads[i], NULL, runBatchWorker, &batch);
+    }
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    waitReclaimer();
+
+    // paths of a job are in the line read for it
+    for (int i = 0; i < batch.numJobs; i++) {
+        free(batch.jobs[i].input);
+    }
+    free(batch.jobs);
+    if (list.size > 0) {
+        munmap(list.buffer, list.size);
+    }
+
+    return batch.numFailed > 0 ? 1 : 0;
+}
+
+// readJobs read the input and output paths of every line of a list
+void readJobs(t_batch *batch, t_input *list) {
+    struct stat status;
+    char *line;
+    char *input;
+    char *output;
+    int allocated = HISTORY_BUFFER_SIZE;
+
+    batch->jobs = malloc(sizeof(t_job) * allocated);
+    batch->numJobs = 0;
+    batch->nextJob = 0;
+    batch->numFailed = 0;
+
+    while (list->offset < list->size) {
+        line = readLine(list);
+        input = strtok(line, " \t");
+        output = strtok(NULL, " \t");
+        // empty lines are skipped
+        if (input == NULL) {
+            free(line);
+            continue;
+        }
+        // a line without an output has nowhere to write, it fails without running
+        if (output == NULL) {
+            fprintf(stderr, "no output file for %s in list\n", input);
+            batch->numFailed++;
+            free(line);
+            continue;
+        }
+        if (batch->numJobs == allocated) {
+            allocated *= 2;
+            batch->jobs = realloc(batch->jobs, sizeof(t_job) * allocated);
+        }
+        batch->jobs[batch->numJobs].input = input;
+        batch->jobs[batch->numJobs].output = output;
+        batch->jobs[batch->numJobs].size = stat(input, &status) == 0 ? status.st_size : 0;
+        batch->numJobs++;
+    }
+}
+
+// compareJobs order jobs from the largest input
+int compareJobs(const void *first, const void *second) {
+    long firstSize = ((t_job *) first)->size;
+    long secondSize = ((t_job *) second)->size;
+
+    return (firstSize < secondSize) - (firstSize > secondSize);
+}
+
+// runBatchWorker run jobs of a batch until none is left
+void *runBatchWorker(void *argument) {
+    t_batch *batch = argument;
+    t_job *job;
+    int next;
+
+    while ((next = __atomic_fetch_add(&batch->nextJob, 1, __ATOMIC_RELAXED)) < batch->numJobs) {
+        job = &batch->jobs[next];
+        if (runJob(job) == false) {
+            fprintf(stderr, "cannot run %s to %s\n", job->input, job->output);
+            __atomic_add_fetch(&batch->numFailed, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+// runJob execute the commands of an input file and write what they print to the output file
+t_boolean runJob(t_job *job) {
+    t_text text;
+    t_history history;
+    t_input input;
+    t_buffer output;
+    t_command *command;
+    FILE *file;
+    t_boolean written;
+    char type;
+
+    if (mapInput(job->input, &input) == false) {
+        return false;
+    }
+
+    createText(&text);
+    createHistory(&history);
+    // whole input is known ahead: edits nobody prints are never built
+    history.maxLazyCommands = INT_MAX;
+    createBuffer(&output);
+    printBuffer = &output;
+
+    command = readCommand(&input);
+    while (command->type != 'q') {
+        type = command->type;
+        TRACE(getCommandName(type), 'B', command->start);
+        executeCommand(command, &text, &history);
+        updateHistory(&history, command, &text);
+        TRACE(getCommandName(type), 'E', 0);
+        command = readCommand(&input);
+    }
+    freeCommand(&command);
+
+    printBuffer = NULL;
+    reclaimText(&text, &history);
+    if (input.size > 0) {
+        munmap(input.buffer, input.size);
+    }
+
+    file = fopen(job->output, "w");
+    written = file != NULL && fwrite(output.data, sizeof(char), output.size, file) == (size_t) output.size;
+    if (file != NULL && fclose(file) != 0) {
+        written = false;
+    }
+    free(output.data);
+
+    return written;
+}
+
+/* ------------------------------
+ * ---------- PIPELINE ----------
+ * ------------------------------
+ */
+
+// startPipeline start the parse and render stages
+void startPipeline(t_pipeline *pipeline, t_input *source) {
+    pipeline->source = source;
+    createQueue(&pipeline->commands, PIPELINE_QUEUE_SIZE);
+    createQueue(&pipeline->outputs, PIPELINE_QUEUE_SIZE);
+    pthread_create(&pipeline->parser, NULL, runParseStage, pipeline);
+    pthread_create(&pipeline->renderer, NULL, runRenderStage, pipeline);
+}
+
+// stopPipeline wait for the outputs to be rendered and print the depths of the queues
+void stopPipeline(t_pipeline *pipeline) {
+    // parse stage is over once it gave the quit
+    pthread_join(pipeline->parser, NULL);
+    pushQueue(&pipeline->outputs, NULL);
+    pthread_join(pipeline->renderer, NULL);
+
+    printQueueStats("commands", &pipeline->commands);
+    printQueueStats("outputs", &pipeline->outputs);
+}
+
+// runParseStage read commands into the queue of the execute stage until quit
+void *runParseStage(void *argument) {
+    t_pipeline *pipeline = argument;
+    t_command *command;
+
+    do {
+        command = readCommand(pipeline->source);
+        pushQueue(&pipeline->commands, command);
+    } while (command->type != 'q');
+
+    return NULL;
+}
+
+// runRenderStage print the outputs of the execute stage until it stops
+void *runRenderStage(void *argument) {
+    t_pipeline *pipeline = argument;
+    t_output *output;
+    t_command command;
+
+    while ((output = popQueue(&pipeline->outputs)) != NULL) {
+        if (output->done == true) {
+            fwrite(output->buffer.data, sizeof(char), output->buffer.size, stdout);
+            free(output->buffer.data);
+        } else {
+            // nodes of a built version never change, the execute stage goes on with new ones
+            command.type = 'p';
+            command.start = output->start;
+            command.end = output->end;
+            printCommand(&command, &output->text);
+        }
+        free(output);
+    }
+    fflush(stdout);
+
+    return NULL;
+}
+
+// renderLater give a print or a fingerprint of the current version to the render stage
+void renderLater(t_pipeline *pipeline, t_command *command, t_text *text, t_history *history) {
+    t_output *output = malloc(sizeof(t_output));
+
+    loadVersion(history, text);
+    if (command->type == 'p') {
+        output->done = false;
+        output->text = *text;
+        output->start = command->start;
+        output->end = command->end;
+    } else {
+        // fingerprints are cached in the store, only this stage writes it
+        createBuffer(&output->buffer);
+        printBuffer = &output->buffer;
+        fingerprintCommand(text);
+        printBuffer = NULL;
+        output->done = true;
+    }
+    pushQueue(&pipeline->outputs, output);
+}
+
+// createQueue create an empty queue of the given size
+void createQueue(t_stageQueue *queue, int size) {
+    queue->items = malloc(sizeof(void *) * size);
+    queue->size = size;
+    queue->first = 0;
+    queue->count = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->notEmpty, NULL);
+    pthread_cond_init(&queue->notFull, NULL);
+    queue->numPushes = 0;
+    queue->totalDepth = 0;
+    queue->maxDepth = 0;
+    queue->numFull = 0;
+    queue->numEmpty = 0;
+}
+
+// pushQueue add an item, waiting while the queue is full
+void pushQueue(t_stageQueue *queue, void *item) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == queue->size) {
+        queue->numFull++;
+    }
+    while (queue->count == queue->size) {
+        pthread_cond_wait(&queue->notFull, &queue->lock);
+    }
+    queue->items[(queue->first + queue->count) % queue->size] = item;
+    queue->count++;
+    queue->numPushes++;
+    queue->totalDepth += queue->count;
+    if (queue->count > queue->maxDepth) {
+        queue->maxDepth = queue->count;
+    }
+    // stage in front only sleeps on an empty queue
+    if (queue->count == 1) {
+        pthread_cond_signal(&queue->notEmpty);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// popQueue take the oldest item, waiting while the queue is empty
+void *popQueue(t_stageQueue *queue) {
+    void *item;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == 0) {
+        queue->numEmpty++;
+    }
+    while (queue->count == 0) {
+        pthread_cond_wait(&queue->notEmpty, &queue->lock);
+    }
+    item = queue->items[queue->first];
+    queue->first = (queue->first + 1) % queue->size;
+    queue->count--;
+    // stage behind sleeps on a full queue until half of it is free, not after every item
+    if (queue->count == queue->size / 2) {
+        pthread_cond_signal(&queue->notFull);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return item;
+}
+
+// printQueueStats print on stderr the depths a queue went through
+void printQueueStats(char *name, t_stageQueue *queue) {
+    fprintf(stderr, "%s queue: %ld items, mean depth %.1f, max depth %d of %d, full %ld times, empty %ld times\n", name, queue->numPushes,
+            queue->numPushes > 0 ? (double) queue->totalDepth / queue->numPushes : 0.0, queue->maxDepth, queue->size, queue->numFull, queue->numEmpty);
+}
+
+#ifdef LATENCY
+/* -----------------------------
+ * ---------- LATENCY ----------
+ * -----------------------------
+ */
+
+// recordLatency count the time taken by a command in the histogram of its type
+void recordLatency(char type, long latency) {
+    t_histogram *histogram = &latencies[getTypeIndex(type)];
+
+    histogram->counts[getLatencyBucket(latency)]++;
+    histogram->total++;
+    if (latency > histogram->max) {
+        histogram->max = latency;
+    }
+}
+
+// getLatencyBucket return the bucket of a latency
+int getLatencyBucket(long latency) {
+    int exponent;
+
+    if (latency < (1L << HISTOGRAM_SUB_BITS)) {
+        return latency > 0 ? latency : 0;
+    }
+    // highest bits after the leading one pick the bucket within its power of two
+    exponent = 63 - __builtin_clzl(latency);
+    return ((exponent - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) + ((latency >> (exponent - HISTOGRAM_SUB_BITS)) & ((1L << HISTOGRAM_SUB_BITS) - 1));
+}
+
+// getBucketLatency return the highest latency counted in a bucket
+long getBucketLatency(int bucket) {
+    int group = bucket >> HISTOGRAM_SUB_BITS;
+    long mantissa = (1L << HISTOGRAM_SUB_BITS) + (bucket & ((1L << HISTOGRAM_SUB_BITS) - 1));
+
+    if (group == 0) {
+        return bucket;
+    }
+    return ((mantissa + 1) << (group - 1)) - 1;
+}
+
+// getPercentile return the latency under which the given share of a histogram is
+long getPercentile(t_histogram *histogram, double share) {
+    long rank = (long) (share * histogram->total + 0.5);
+    long count = 0;
+
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        count += histogram->counts[i];
+        if (count >= rank) {
+            // a bucket may reach past the highest latency seen
+            return getBucketLatency(i) < histogram->max ? getBucketLatency(i) : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+// printLatencies print on stderr a summary of the histogram of every command type
+void printLatencies() {
+    t_histogram *histogram;
+
+    for (int i = 0; i < (int) sizeof(COMMAND_TYPES); i++) {
+        histogram = &latencies[i];
+        if (histogram->total == 0) {
+            continue;
+        }
+        fprintf(stderr, "latency %c: %ld commands, p50 %ld ns, p90 %ld ns, p99 %ld ns, max %ld ns\n", i < (int) sizeof(COMMAND_TYPES) - 1 ? COMMAND_TYPES[i] : '?', histogram->total,
+                getPercentile(histogram, 0.5), getPercentile(histogram, 0.9), getPercentile(histogram, 0.99), histogram->max);
+    }
+}
+
+// requestLatencies ask the main loop for a summary of the histograms
+void requestLatencies(int signal) {
+    latenciesRequested = signal == SIGUSR1;
+}
+#endif
+
+/* ---------------------------
+ * ---------- TRACE ----------
+ * ---------------------------
+ */
+
+// startTrace record events until exit, then write them to the given file
+void startTrace(char *path) {
+    trace.path = path;
+    trace.start = getTimeNanos();
+    __atomic_store_n(&traceEnabled, true, __ATOMIC_SEQ_CST);
+    atexit(writeTrace);
+}
+
+// traceEvent add an event to the buffer of this thread
+void traceEvent(const char *name, char phase, long argument) {
+    t_traceEvent *event;
+
+    // buffer is only written by its thread, the list is locked when a thread joins it
+    if (traceBuffer == NULL) {
+        traceBuffer = malloc(sizeof(t_traceBuffer));
+        traceBuffer->numEvents = 0;
+        traceBuffer->busy = 0;
+        traceBuffer->thread = syscall(SYS_gettid);
+        pthread_mutex_lock(&trace.lock);
+        traceBuffer->next = trace.first;
+        trace.first = traceBuffer;
+        pthread_mutex_unlock(&trace.lock);
+    }
+
+    // either this thread sees tracing stopped, or writeTrace sees the buffer busy and waits
+    __atomic_store_n(&traceBuffer->busy, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&traceEnabled, __ATOMIC_SEQ_CST) == true) {
+        event = &traceBuffer->events[traceBuffer->numEvents % TRACE_EVENTS];
+        event->name = name;
+        event->time = getTimeNanos();
+        event->argument = argument;
+        event->phase = phase;
+        traceBuffer->numEvents++;
+    }
+    __atomic_store_n(&traceBuffer->busy, 0, __ATOMIC_RELEASE);
+}
+
+// writeTrace write the events of every thread in chrome trace format
+void writeTrace() {
+    t_traceBuffer *buffer;
+    t_traceEvent *event;
+    FILE *file;
+    long first;
+    t_boolean separator = false;
+
+    // threads still running stop adding events, the ones adding one finish it first
+    __atomic_store_n(&traceEnabled, false, __ATOMIC_SEQ_CST);
+    file = fopen(trace.path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "cannot write trace %s\n", trace.path);
+        return;
+    }
+
+    fprintf(file, "{\"traceEvents\":[");
+    pthread_mutex_lock(&trace.lock);
+    for (buffer = trace.first; buffer != NULL; buffer = buffer->next) {
+        while (__atomic_load_n(&buffer->busy, __ATOMIC_SEQ_CST) == 1) {
+            sched_yield();
+        }
+        // a full buffer starts at its oldest event
+        first = buffer->numEvents > TRACE_EVENTS ? buffer->numEvents - TRACE_EVENTS : 0;
+        for (long i = first; i < buffer->numEvents; i++) {
+            event = &buffer->events[i % TRACE_EVENTS];
+            fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d", separator == true ? "," : "", event->name, event->phase,
+                    (event->time - trace.start) / 1000.0, (int) getpid(), buffer->thread);
+            if (event->phase == 'i') {
+                fprintf(file, ",\"s\":\"t\"");
+            }
+            if (event->phase != 'E') {
+                fprintf(file, ",\"args\":{\"value\":%ld}", event->argument);
+            }
+            fprintf(file, "}");
+            separator = true;
+        }
+    }
+    pthread_mutex_unlock(&trace.lock);
+    fprintf(file, "\n]}\n");
+    fclose(file);
+}
+
+// getCommandName return the name of a command type
+const char *getCommandName(char type) {
+    switch (type) {
+        case 'c':
+            return "change";
+        case 'd':
+            return "delete";
+        case 'p':
+            return "print";
+        case 'u':
+            return "undo";
+        case 'r':
+            return "redo";
+        case 'v':
+            return "checkout";
+        case 'h':
+            return "fingerprint";
+        case 's':
+            return "save";
+        default:
+            return "unknown";
+    }
+}
+
+/* ----------------------------
+ * ---------- MEMORY ----------
+ * ----------------------------
+ */
+
+// countMemory add the given bytes to a category, negative when they are freed
+void countMemory(t_memoryCategory category, long bytes) {
+    updateCounter(&memoryCounters[category], bytes);
+    updateCounter(&memoryCounters[MEMORY_CATEGORIES], bytes);
+}
+
+// updateCounter add the given bytes to a counter and update its peak
+void updateCounter(t_memoryCounter *counter, long bytes) {
+    long current = __atomic_add_fetch(&counter->current, bytes, __ATOMIC_RELAXED);
+    long peak = __atomic_load_n(&counter->peak, __ATOMIC_RELAXED);
+
+    // sessions of the server count at the same time, a failed exchange reads the newer peak
+    while (current > peak) {
+        if (__atomic_compare_exchange_n(&counter->peak, &peak, current, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED) == true) {
+            break;
+        }
+    }
+}
+
+// printMemory print on stderr the bytes in use by every category
+void printMemory() {
+    for (int i = 0; i <= MEMORY_CATEGORIES; i++) {
+        fprintf(stderr, "memory %s: %ld bytes, peak %ld bytes\n", memoryNames[i], __atomic_load_n(&memoryCounters[i].current, __ATOMIC_RELAXED),
+                __atomic_load_n(&memoryCounters[i].peak, __ATOMIC_RELAXED));
+    }
+}
+
+// requestMemory ask for a memory report after the command being executed
+void requestMemory(int signal) {
+    memoryRequested = signal == SIGUSR2;
+}
+
+/* --------------------------
+ * ---------- WORK ----------
+ * --------------------------
+ */
+
+// recordWork count the work of a command from the nodes and copies the store had before it and the versions it added
+void recordWork(t_command *command, t_store *store, long numNodes, long numCopies, int numVersions) {
+    t_work *counters = &work[getTypeIndex(command->type)];
+    // every new node that is not a copy holds a new line
+    long nodesCopied = store->numCopies - numCopies;
+
+    counters->numCommands++;
+    counters->nodesCopied += nodesCopied;
+    counters->nodesCreated += store->numNodes - numNodes - nodesCopied;
+    counters->bytesCopied += nodesCopied * sizeof(t_node) + numVersions * sizeof(t_version);
+    // edits are counted as given, lazy ones do not know the size of their text yet
+    if (command->type == 'c') {
+        counters->linesEdited += command->data.numLines;
+    } else if (command->type == 'd' && command->end > 0 && command->end >= command->start) {
+        counters->linesEdited += command->end - (command->start > 0 ? command->start : 1) + 1;
+    }
+}
+
+// printWork print on stderr the work of every command type and its ratio to the lines edited
+void printWork() {
+    t_work total = {0, 0, 0, 0, 0};
+    t_work *counters;
+
+    for (int i = 0; i <= (int) sizeof(COMMAND_TYPES); i++) {
+        // last row is the total, builds done by prints and undos are work of the edits they apply
+        counters = i < (int) sizeof(COMMAND_TYPES) ? &work[i] : &total;
+        if (counters->numCommands == 0) {
+            continue;
+        }
+        fprintf(stderr, "work %s: %ld commands, %ld lines edited, %ld nodes copied, %ld nodes created, %ld bytes copied", i < (int) sizeof(COMMAND_TYPES) ? getCommandName(COMMAND_TYPES[i]) : "total",
+                counters->numCommands, counters->linesEdited, counters->nodesCopied, counters->nodesCreated, counters->bytesCopied);
+        if (counters->linesEdited > 0) {
+            fprintf(stderr, ", %.2f nodes per line edited", (double) (counters->nodesCopied + counters->nodesCreated) / counters->linesEdited);
+        }
+        fprintf(stderr, "\n");
+        total.numCommands += counters->numCommands;
+        total.linesEdited += counters->linesEdited;
+        total.nodesCopied += counters->nodesCopied;
+        total.nodesCreated += counters->nodesCreated;
+        total.bytesCopied += counters->bytesCopied;
+    }
+}
+
+/* --------------------------
+ * ---------- PERF ----------
+ * --------------------------
+ */
+
+// openPerf open the counters of this thread, and enable them if any is available
+void openPerf() {
+    struct perf_event_attr attributes;
+    int counter;
+
+    perf.leader = -1;
+    perf.numOpened = 0;
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        memset(&attributes, 0, sizeof(struct perf_event_attr));
+        attributes.size = sizeof(struct perf_event_attr);
+        attributes.type = perfEvents[i].type;
+        attributes.config = perfEvents[i].config;
+        attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // unprivileged processes can only count their own user code
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        counter = syscall(SYS_perf_event_open, &attributes, 0, -1, perf.leader, PERF_FLAG_FD_CLOEXEC);
+        if (counter < 0) {
+            // containers and virtual machines often have no hardware counters
+            fprintf(stderr, "perf: %s not available: %s\n", perfEvents[i].name, strerror(errno));
+            perf.positions[i] = -1;
+            continue;
+        }
+        if (perf.leader < 0) {
+            perf.leader = counter;
+        }
+        perf.positions[i] = perf.numOpened;
+        perf.numOpened++;
+    }
+
+    perf.enabled = perf.numOpened > 0 && readPerf(perf.last) == true;
+    if (perf.enabled == false) {
+        fprintf(stderr, "perf: no counter available, commands are not profiled\n");
+    }
+}
+
+// readPerf read every counter available
+t_boolean readPerf(unsigned long long *values) {
+    // number of counters and times, then the counters in the order they were opened
+    unsigned long long group[3 + PERF_EVENTS];
+
+    if (read(perf.leader, group, sizeof(unsigned long long) * (3 + perf.numOpened)) != (long) (sizeof(unsigned long long) * (3 + perf.numOpened))) {
+        return false;
+    }
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        values[i] = perf.positions[i] >= 0 ? group[3 + perf.positions[i]] : 0;
+    }
+    perf.timeEnabled = group[1];
+    perf.timeRunning = group[2];
+    return true;
+}
+
+// countPhase add the counters since the end of the previous phase to a phase of a command type
+void countPhase(char type, t_phase phase) {
+    unsigned long long values[PERF_EVENTS];
+    int index = getTypeIndex(type);
+
+    if (readPerf(values) == false) {
+        return;
+    }
+    // NUM_PHASES only starts the next phase
+    if (phase < NUM_PHASES) {
+        for (int i = 0; i < PERF_EVENTS; i++) {
+            perf.counts[index][phase][i] += values[i] - perf.last[i];
+        }
+    }
+    if (phase == PARSE_PHASE) {
+        perf.numCommands[index]++;
+    }
+    memcpy(perf.last, values, sizeof(perf.last));
+}
+
+// printPerf print on stderr the counters of every command type and phase, per command
+void printPerf() {
+    unsigned long long *counts;
+    unsigned long long sum;
+
+    for (int i = 0; i < (int) sizeof(COMMAND_TYPES); i++) {
+        if (perf.numCommands[i] == 0) {
+            continue;
+        }
+        for (int phase = 0; phase < NUM_PHASES; phase++) {
+            counts = perf.counts[i][phase];
+            // only prints and fingerprints have a print phase
+            sum = 0;
+            for (int j = 0; j < PERF_EVENTS; j++) {
+                sum += counts[j];
+            }
+            if (sum == 0) {
+                continue;
+            }
+            fprintf(stderr, "perf %s %s: %ld commands", i < (int) sizeof(COMMAND_TYPES) - 1 ? getCommandName(COMMAND_TYPES[i]) : "other", phaseNames[phase], perf.numCommands[i]);
+            for (int j = 0; j < PERF_EVENTS; j++) {
+                if (perf.positions[j] >= 0) {
+                    fprintf(stderr, ", %.0f %s", (double) counts[j] / perf.numCommands[i], perfEvents[j].name);
+                }
+            }
+            if (perf.positions[0] >= 0 && perf.positions[1] >= 0 && counts[0] > 0) {
+                fprintf(stderr, ", %.2f IPC", (double) counts[1] / counts[0]);
+            }
+            fprintf(stderr, "\n");
+        }
+    }
+    // hardware multiplexes a group that does not fit, values only cover the time it ran
+    if (perf.timeRunning < perf.timeEnabled) {
+        fprintf(stderr, "perf: counters ran %.1f%% of the time\n", 100.0 * perf.timeRunning / perf.timeEnabled);
     }
-    *new = command;
-    // set command as head for the second commands stack
-    *old = app;
-    return;
 }
 
 /* ----------------------------------
@@ -608,174 +4351,481 @@ void moveEventBetweenStack(t_command *command, t_command **old, t_command **new)
 
 // createText create a new empty text struct
 void createText(t_text *text) {
+    text->store = createStore();
+    text->root = EMPTY_TREE;
     text->numLines = 0;
-    text->lines = malloc(sizeof(char *) * TEXT_BUFFER_SIZE);
-    text->buffersAllocated = 1;
     return;
 }
 
-// printText print text from start to end
-void printText(t_text *text, int start, int end) {
-    int numLinesToPrint = end - start + 1;
-    int startOffset = start - 1;
+// freeText free a text with every version of its history
+void freeText(t_text *text, t_history *history) {
+    t_store *store = text->store;
+    t_command *command;
+    t_savedLine *lines;
+    long numLines = 1;
+    long count = store->numNodes;
+    long size = 0;
+
+    TRACE("freeText", 'B', store->numNodes);
+    // lines are shared by nodes and by edits not built yet, each one is freed once
+    for (int i = 1; i < history->numVersions; i++) {
+        if (history->versions[i].command != NULL) {
+            count += history->versions[i].command->data.numLines;
+        }
+    }
+    while (numLines < 2 * count) {
+        numLines *= 2;
+    }
+    lines = calloc(numLines, sizeof(t_savedLine));
+    for (int i = 1; i < store->numNodes; i++) {
+        findSavedLine(lines, numLines, getLine(getNode(store, i)))->line = getLine(getNode(store, i));
+    }
+    for (int i = 1; i < history->numVersions; i++) {
+        command = history->versions[i].command;
+        if (command != NULL) {
+            for (int j = 0; j < command->data.numLines; j++) {
+                findSavedLine(lines, numLines, command->data.lines[j])->line = command->data.lines[j];
+            }
+            freeCommand(&history->versions[i].command);
+        }
+    }
+    for (long i = 0; i < numLines; i++) {
+        if (lines[i].line != NULL) {
+            size += strlen(lines[i].line) + 1;
+            free(lines[i].line);
+        }
+    }
+    free(lines);
+    COUNT_MEMORY(LINE_MEMORY, -size);
+
+    size = sizeof(t_store) + sizeof(unsigned long long) * store->numPowers;
+    for (int i = 0; i <= (store->numNodes - 1) >> NODE_CHUNK_BITS; i++) {
+        size += sizeof(t_node) * NODE_CHUNK_SIZE;
+        if (store->fingerprints[i] != NULL) {
+            size += sizeof(unsigned long long) * NODE_CHUNK_SIZE;
+        }
+        free(store->chunks[i]);
+        free(store->fingerprints[i]);
+    }
+    COUNT_MEMORY(NODE_MEMORY, -size);
+    COUNT_MEMORY(VERSION_MEMORY, -(long) sizeof(t_version) * history->versionsAllocated);
+    free(store->powers);
+    free(store);
+    free(history->versions);
+    TRACE("freeText", 'E', 0);
+}
 
-    for(int i = 0; i < numLinesToPrint; i++) {
-        printLine(text->lines[startOffset + i]);
+// reclaimText give a text with its history to the reclaimer, which frees them later
+void reclaimText(t_text *text, t_history *history) {
+    t_garbage *garbage = malloc(sizeof(t_garbage));
+
+    // freeing every line of a large session would hold the thread running the next one
+    garbage->text = *text;
+    garbage->history = *history;
+    pthread_once(&reclaimer.started, startReclaimer);
+    pthread_mutex_lock(&reclaimer.lock);
+    garbage->next = reclaimer.first;
+    reclaimer.first = garbage;
+    reclaimer.numPending++;
+    pthread_cond_signal(&reclaimer.ready);
+    pthread_mutex_unlock(&reclaimer.lock);
+}
+
+// waitReclaimer wait until every text given to the reclaimer is freed
+void waitReclaimer() {
+    pthread_mutex_lock(&reclaimer.lock);
+    while (reclaimer.numPending > 0) {
+        pthread_cond_wait(&reclaimer.idle, &reclaimer.lock);
     }
+    pthread_mutex_unlock(&reclaimer.lock);
+}
 
-    return;
+// startReclaimer start the thread freeing texts
+void startReclaimer() {
+    pthread_create(&reclaimer.thread, NULL, runReclaimer, NULL);
 }
 
-// changeText modify text from start with data and length given
-t_text changeText(t_text *text, t_text data, int start) {
-    t_text prevData;
-    int end = start + data.numLines - 1;
+// runReclaimer free the texts given to the reclaimer
+void *runReclaimer(void *argument) {
+    t_garbage *garbage;
+    t_garbage *next;
 
-    prevData = getEmptyTextStruct();
+    while (true) {
+        pthread_mutex_lock(&reclaimer.lock);
+        while (reclaimer.first == NULL) {
+            pthread_cond_wait(&reclaimer.ready, &reclaimer.lock);
+        }
+        garbage = reclaimer.first;
+        reclaimer.first = NULL;
+        pthread_mutex_unlock(&reclaimer.lock);
+
+        for (; garbage != NULL; garbage = next) {
+            next = garbage->next;
+            freeText(&garbage->text, &garbage->history);
+            free(garbage);
+            pthread_mutex_lock(&reclaimer.lock);
+            reclaimer.numPending--;
+            if (reclaimer.numPending == 0) {
+                pthread_cond_broadcast(&reclaimer.idle);
+            }
+            pthread_mutex_unlock(&reclaimer.lock);
+        }
+    }
 
-    if(start > text->numLines) {
-        checkAndReallocText(text, end);
-        appendText(text, data, 0);
-    } else {
-        if(end <= text->numLines) {
-            prevData = readAndOverwriteText(text, data, start, end);
+    return argument;
+}
+
+// printText print text from start to end
+void printText(t_text *text, int start, int end) {
+    if (printThreads > 1 && end - start + 1 >= PARALLEL_PRINT_LINES) {
+        printRanges(text, start, end);
+        return;
+    }
+    printNodes(text->store, text->root, start - 1, end - 1);
+    return;
+}
+
+// printRanges print a large part of text split between threads, in order
+void printRanges(t_text *text, int start, int end) {
+    t_printRange *ranges;
+    long numLines = end - start + 1;
+
+    ranges = malloc(sizeof(t_printRange) * printThreads);
+    for (int i = 0; i < printThreads; i++) {
+        ranges[i].text = text;
+        ranges[i].start = start + numLines * i / printThreads;
+        ranges[i].end = start + numLines * (i + 1) / printThreads - 1;
+        if (i > 0) {
+            pthread_create(&ranges[i].thread, NULL, formatRange, &ranges[i]);
+        }
+    }
+
+    // first range goes out directly while the others are formatted
+    printNodes(text->store, text->root, ranges[0].start - 1, ranges[0].end - 1);
+    for (int i = 1; i < printThreads; i++) {
+        pthread_join(ranges[i].thread, NULL);
+        if (printBuffer != NULL) {
+            appendBuffer(printBuffer, ranges[i].buffer.data, ranges[i].buffer.size);
         } else {
-            prevData = readAndOverwriteText(text, data, start, text->numLines);
-            checkAndReallocText(text, end);
-            appendText(text, data, text->numLines - start + 1);
+            fwrite(ranges[i].buffer.data, sizeof(char), ranges[i].buffer.size, stdout);
         }
+        free(ranges[i].buffer.data);
+    }
+    free(ranges);
+}
+
+// formatRange format the lines of a range in its buffer
+void *formatRange(void *argument) {
+    t_printRange *range = argument;
+
+    // text does not change until the print is over
+    createBuffer(&range->buffer);
+    printBuffer = &range->buffer;
+    printNodes(range->text->store, range->text->root, range->start - 1, range->end - 1);
+    printBuffer = NULL;
+
+    return NULL;
+}
+
+// changeText modify text from start with data given
+void changeText(t_text *text, t_lines data, int start) {
+    int left, middle, right;
+
+    // lines after the end of text are appended
+    if (start > text->numLines) {
+        start = text->numLines + 1;
     }
 
-    return prevData;
+    // replaced lines are cut out, the old tree is left unchanged
+    splitTree(text->store, text->root, start - 1, &left, &right);
+    splitTree(text->store, right, data.numLines, &middle, &right);
+    middle = buildTree(text->store, data);
+
+    text->root = mergeTrees(text->store, mergeTrees(text->store, left, middle), right);
+    text->numLines = getTreeSize(text->store, text->root);
+
+    return;
 }
 
 // deleteText delete text from start to end given
 void deleteText(t_text *text, t_command *command) {
-
+    int left, middle, right;
     int numLinesToDelete = command->end - command->start + 1;
 
-    // shift lines
-    command->prevData = shiftAndReadText(text, command->start, command->end);
+    splitTree(text->store, text->root, command->start - 1, &left, &right);
+    splitTree(text->store, right, numLinesToDelete, &middle, &right);
 
+    text->root = mergeTrees(text->store, left, right);
     // save new num lines
-    text -> numLines = text -> numLines - numLinesToDelete;
+    text->numLines = text->numLines - numLinesToDelete;
 
     return;
 }
 
-// readAndOverwriteText overwrite text while reading previous data
-t_text readAndOverwriteText(t_text *text, t_text data, int start, int end) {
-    int startOffset = start - 1;
-    int numLinesToWrite = 0;
-    int currNumLine = 0;
-    t_text prevData;
-    int dataCounter = 0;
+/* -------------------------------
+ * ---------- LINE TREE ----------
+ * -------------------------------
+ */
 
-    // check for overflow
-    if(end > text->numLines) {
-        numLinesToWrite = text->numLines - start + 1;
-    } else {
-        numLinesToWrite = end - start + 1;
-    }
+// createStore create a new store with only the empty tree
+t_store *createStore() {
+    t_store *store;
+    t_node *empty;
+
+    store = calloc(1, sizeof(t_store));
+    store->chunks[0] = malloc(sizeof(t_node) * NODE_CHUNK_SIZE);
+    COUNT_MEMORY(NODE_MEMORY, sizeof(t_store) + sizeof(t_node) * NODE_CHUNK_SIZE);
+    empty = &store->chunks[0][EMPTY_TREE];
+    empty->left = EMPTY_TREE;
+    empty->right = EMPTY_TREE;
+    empty->size = 0;
+    empty->priority = 0;
+    empty->line = 0;
+    store->numNodes = 1;
+    // fixed seed, runs are repeatable
+    store->seed = 2463534242u;
+
+    return store;
+}
 
-    prevData.numLines = text->numLines;
-    prevData.lines = malloc(sizeof(char *) * prevData.numLines);
-    prevData.buffersAllocated = 0;
+// getNode return the node with the given index
+t_node *getNode(t_store *store, int index) {
+    return &store->chunks[index >> NODE_CHUNK_BITS][index & (NODE_CHUNK_SIZE - 1)];
+}
 
-    for(int i = 0; i < startOffset; i++) {
-        // save prevData
-        prevData.lines[dataCounter] = text->lines[i];
-        dataCounter++;
-    }
+// createNode create a new node with the given line
+int createNode(t_store *store, char *line) {
+    t_node *node;
+    int index = store->numNodes;
 
-    for(int i = 0; i < numLinesToWrite; i++) {
-        currNumLine = startOffset + i;
-        // save prevData
-        prevData.lines[dataCounter] = text->lines[currNumLine];
-        dataCounter++;
-        // write data
-        text->lines[currNumLine] = data.lines[i];
+    if ((index & (NODE_CHUNK_SIZE - 1)) == 0) {
+        TRACE("allocateNodes", 'i', index >> NODE_CHUNK_BITS);
+        store->chunks[index >> NODE_CHUNK_BITS] = malloc(sizeof(t_node) * NODE_CHUNK_SIZE);
+        COUNT_MEMORY(NODE_MEMORY, sizeof(t_node) * NODE_CHUNK_SIZE);
     }
+    store->numNodes++;
 
-    startOffset += numLinesToWrite;
+    // xorshift
+    store->seed ^= store->seed << 13;
+    store->seed ^= store->seed >> 17;
+    store->seed ^= store->seed << 5;
 
-    for(int i = 0; i < text->numLines - startOffset; i++) {
-        // save prevData
-        prevData.lines[dataCounter] = text->lines[startOffset + i];
-        dataCounter++;
-    }
+    node = getNode(store, index);
+    node->left = EMPTY_TREE;
+    node->right = EMPTY_TREE;
+    node->size = 1;
+    node->priority = store->seed;
+    node->line = line - (char *) node;
+
+    return index;
+}
+
+// copyNode create a copy of the given node
+int copyNode(t_store *store, int index) {
+    int copy = createNode(store, NULL);
+    t_node *node = getNode(store, index);
+    t_node *copied = getNode(store, copy);
+
+    store->numCopies++;
+    *copied = *node;
+    copied->line += (char *) node - (char *) copied;
+    return copy;
+}
 
-    return prevData;
+// getLine return the line of a node
+char *getLine(t_node *node) {
+    return (char *) node + node->line;
 }
 
-// appendText add new text to the end
-void appendText(t_text *text, t_text data, int numLinesAlreadyWritten) {
-    int numLinesToWrite = data.numLines - numLinesAlreadyWritten;
-    int startOffset = text->numLines;
+// getTreeSize return the number of lines in a tree
+int getTreeSize(t_store *store, int root) {
+    return getNode(store, root)->size;
+}
+
+// updateNode update size of a node from its children
+void updateNode(t_store *store, int index) {
+    t_node *node = getNode(store, index);
+    node->size = getTreeSize(store, node->left) + getTreeSize(store, node->right) + 1;
+}
+
+// getFingerprint return the fingerprint of the lines of a tree
+unsigned long long getFingerprint(t_store *store, int root) {
+    unsigned long long **chunk = &store->fingerprints[root >> NODE_CHUNK_BITS];
+    unsigned long long *fingerprint;
+    unsigned long long value;
+    t_node *node;
 
-    for(int i = 0; i < numLinesToWrite; i++) {
-        text->lines[startOffset + i] = data.lines[numLinesAlreadyWritten + i];
-        text->numLines++;
+    if (root == EMPTY_TREE) {
+        return 0;
+    }
+    if (*chunk == NULL) {
+        *chunk = malloc(sizeof(unsigned long long) * NODE_CHUNK_SIZE);
+        COUNT_MEMORY(NODE_MEMORY, sizeof(unsigned long long) * NODE_CHUNK_SIZE);
+        memset(*chunk, 0xff, sizeof(unsigned long long) * NODE_CHUNK_SIZE);
     }
 
-    return;
+    // nodes never change, only nodes created after the last fingerprint are visited
+    fingerprint = &(*chunk)[root & (NODE_CHUNK_SIZE - 1)];
+    if (*fingerprint == NO_FINGERPRINT) {
+        node = getNode(store, root);
+        // lines of the left subtree, then the line of the node, then the right subtree
+        value = multiplyModulo(getFingerprint(store, node->left), FINGERPRINT_BASE) + hashLine(getLine(node));
+        value = value >= FINGERPRINT_PRIME ? value - FINGERPRINT_PRIME : value;
+        value = multiplyModulo(value, getPower(store, getTreeSize(store, node->right))) + getFingerprint(store, node->right);
+        *fingerprint = value >= FINGERPRINT_PRIME ? value - FINGERPRINT_PRIME : value;
+    }
+    return *fingerprint;
 }
 
-// getTextBuffersRequired get buffers required for a text with length given
-int getTextBuffersRequired(int numLines) {
-    return numLines / TEXT_BUFFER_SIZE + 1;
+// getPower return the fingerprint base raised to the given exponent
+unsigned long long getPower(t_store *store, int exponent) {
+    int numPowers = store->numPowers > 0 ? store->numPowers : 1;
+
+    if (exponent >= store->numPowers) {
+        while (numPowers <= exponent) {
+            numPowers *= 2;
+        }
+        store->powers = realloc(store->powers, sizeof(unsigned long long) * numPowers);
+        COUNT_MEMORY(NODE_MEMORY, sizeof(unsigned long long) * (numPowers - store->numPowers));
+        store->powers[0] = 1;
+        for (int i = store->numPowers > 0 ? store->numPowers : 1; i < numPowers; i++) {
+            store->powers[i] = multiplyModulo(store->powers[i - 1], FINGERPRINT_BASE);
+        }
+        store->numPowers = numPowers;
+    }
+    return store->powers[exponent];
 }
 
-// checkAndReallocText check if text needs reallocation
-void checkAndReallocText(t_text *text, int newNumLines) {
-    int buffersRequired = getTextBuffersRequired(newNumLines);
-    if(buffersRequired > text->buffersAllocated) {
-        text->buffersAllocated = buffersRequired;
-        text->lines = realloc(text->lines, sizeof(char *) * TEXT_BUFFER_SIZE * text->buffersAllocated);
+// hashLine return the fingerprint of a single line
+unsigned long long hashLine(char *line) {
+    // FNV-1a
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; line[i] != '\0'; i++) {
+        hash ^= (unsigned char) line[i];
+        hash *= 0x100000001b3ULL;
     }
+    return hash % FINGERPRINT_PRIME;
 }
 
-// shiftAndReadText shift text from start to end given while reading previous data
-t_text shiftAndReadText(t_text *text, int start, int end)
-{
-    t_text data;
-    int numLinesToDelete = end - start + 1;
-    int startOffset = start - 1;
-    int endOffset = end;
-    int dataCounter = 0;
+// multiplyModulo multiply two fingerprints modulo the fingerprint prime
+unsigned long long multiplyModulo(unsigned long long a, unsigned long long b) {
+    unsigned __int128 product = (unsigned __int128) a * b;
+    // 2^61 is 1 modulo the prime, high bits are added to low bits
+    unsigned long long result = (unsigned long long) (product & FINGERPRINT_PRIME) + (unsigned long long) (product >> 61);
+
+    return result >= FINGERPRINT_PRIME ? result - FINGERPRINT_PRIME : result;
+}
+
+// splitTree split a tree after the first given lines without changing it
+void splitTree(t_store *store, int root, int numLines, int *left, int *right) {
+    t_node *node;
+    int copy;
+
+    // nothing to cut, tree is shared as it is
+    if (numLines <= 0) {
+        *left = EMPTY_TREE;
+        *right = root;
+        return;
+    }
+    if (numLines >= getTreeSize(store, root)) {
+        *left = root;
+        *right = EMPTY_TREE;
+        return;
+    }
 
-    data.numLines = text->numLines;
-    if(text->buffersAllocated == 0) {
-        data.lines = malloc(sizeof(char *) * TEXT_BUFFER_SIZE);
-        data.buffersAllocated = 1;
+    // nodes on the cut path are copied, nodes never change once created
+    copy = copyNode(store, root);
+    node = getNode(store, copy);
+    if (numLines <= getTreeSize(store, node->left)) {
+        splitTree(store, node->left, numLines, left, &node->left);
+        *right = copy;
     } else {
-        data.lines = malloc(sizeof(char *) * text->buffersAllocated * TEXT_BUFFER_SIZE);
-        data.buffersAllocated = text->buffersAllocated;
+        splitTree(store, node->right, numLines - getTreeSize(store, node->left) - 1, &node->right, right);
+        *left = copy;
     }
+    updateNode(store, copy);
+}
+
+// mergeTrees return a tree with lines of the first tree and then the second
+int mergeTrees(t_store *store, int left, int right) {
+    int copy;
+    int merged;
 
-    for(int i = 0; i < startOffset; i++) {
-        // save prev data
-        data.lines[dataCounter] = text->lines[i];
-        dataCounter++;
+    if (left == EMPTY_TREE) {
+        return right;
+    }
+    if (right == EMPTY_TREE) {
+        return left;
     }
 
-    for(int i = 0; i < text->numLines - numLinesToDelete; i++) {
-        // save prev data
-        data.lines[dataCounter] = text->lines[startOffset + i];
-        dataCounter++;
-        // overwrite lines from start to end
-        text -> lines[startOffset + i] = text->lines[endOffset + i];
+    if (getNode(store, left)->priority > getNode(store, right)->priority) {
+        merged = mergeTrees(store, getNode(store, left)->right, right);
+        copy = copyNode(store, left);
+        getNode(store, copy)->right = merged;
+    } else {
+        merged = mergeTrees(store, left, getNode(store, right)->left);
+        copy = copyNode(store, right);
+        getNode(store, copy)->left = merged;
     }
+    updateNode(store, copy);
 
-    // some rows already shifted
-    startOffset = text->numLines - numLinesToDelete;
-    for(int i = 0; i < numLinesToDelete; i++) {
-        // save prev data
-        data.lines[dataCounter] = text->lines[startOffset + i];
-        dataCounter++;
+    return copy;
+}
+
+// buildTree build a tree with the given lines
+int buildTree(t_store *store, t_lines data) {
+    int *stack;
+    int numStack = 0;
+    int index, last;
+
+    // lines are in order, only the right spine is open while building
+    stack = malloc(sizeof(int) * (data.numLines + 1));
+    for (int i = 0; i < data.numLines; i++) {
+        index = createNode(store, data.lines[i]);
+        last = EMPTY_TREE;
+        while (numStack > 0 && getNode(store, stack[numStack - 1])->priority < getNode(store, index)->priority) {
+            last = stack[numStack - 1];
+            updateNode(store, last);
+            numStack--;
+        }
+        getNode(store, index)->left = last;
+        if (numStack > 0) {
+            getNode(store, stack[numStack - 1])->right = index;
+        }
+        stack[numStack] = index;
+        numStack++;
     }
+    // sizes of the right spine are updated from the bottom
+    for (int i = numStack - 1; i >= 0; i--) {
+        updateNode(store, stack[i]);
+    }
+    index = numStack > 0 ? stack[0] : EMPTY_TREE;
 
-    return data;
+    free(stack);
+    return index;
+}
+
+// printNodes print lines of a tree from start to end
+void printNodes(t_store *store, int root, int start, int end) {
+    t_node *node;
+    int position;
+
+    if (root == EMPTY_TREE || start > end) {
+        return;
+    }
+
+    node = getNode(store, root);
+    position = getTreeSize(store, node->left);
+    if (start < position) {
+        printNodes(store, node->left, start, end < position - 1 ? end : position - 1);
+    }
+    if (start <= position && position <= end) {
+        printLine(getLine(node));
+    }
+    if (end > position) {
+        printNodes(store, node->right, start > position + 1 ? start - position - 1 : 0, end - position - 1);
+    }
 }
 
 /* ------------------------------------------
@@ -783,20 +4833,43 @@ t_text shiftAndReadText(t_text *text, int start, int end)
  * ------------------------------------------
  */
 
-// readLine read a line from stdin
-char *readLine() {
+// readLine read a line from input (stdin when NULL)
+char *readLine(t_input *input) {
     int i;
     char c;
-    char *line = malloc(sizeof(char) * (MAX_LINE_LENGTH + 1));
+    char *line;
+    char *end;
+
+    if (input != NULL) {
+        // missing lines at the end of input are read as quit
+        if (input->offset >= input->size) {
+            line = malloc(sizeof(char) * 2);
+            strcpy(line, "q");
+            return line;
+        }
+        end = memchr(input->buffer + input->offset, '\n', input->size - input->offset);
+        if (end == NULL) {
+            end = input->buffer + input->size;
+        }
+        i = end - (input->buffer + input->offset);
+        line = malloc(sizeof(char) * (i + 1));
+        memcpy(line, input->buffer + input->offset, i);
+        line[i] = '\0';
+        input->offset += i + 1;
+        return line;
+    }
+
+    line = malloc(sizeof(char) * (MAX_LINE_LENGTH + 1));
 
-    c = getchar();
+    // stdin is read by one thread only, the main thread or the parse stage of --pipeline, so its lock is not needed
+    c = getchar_unlocked();
     i = 0;
 
     while (c != '\n') {
         line[i] = c;
         i++;
 
-        c = getchar();
+        c = getchar_unlocked();
     }
     line[i] = '\0';
     i++;
@@ -806,44 +4879,212 @@ char *readLine() {
     return line;
 }
 
+// readInput read the whole stdin in memory
+void readInput(t_input *input) {
+    long bytesRead;
+    long allocated = INPUT_BUFFER_SIZE;
+
+    input->buffer = malloc(sizeof(char) * allocated);
+    input->size = 0;
+    input->offset = 0;
+
+    while ((bytesRead = fread(input->buffer + input->size, 1, allocated - input->size, stdin)) > 0) {
+        input->size += bytesRead;
+        if (input->size == allocated) {
+            allocated *= 2;
+            input->buffer = realloc(input->buffer, sizeof(char) * allocated);
+        }
+    }
+}
+
+// mapInput map a whole file as input
+t_boolean mapInput(char *path, t_input *input) {
+    struct stat status;
+    int file;
+
+    file = open(path, O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    if (fstat(file, &status) != 0) {
+        close(file);
+        return false;
+    }
+
+    input->buffer = NULL;
+    input->size = status.st_size;
+    input->offset = 0;
+    // an empty file has nothing to map
+    if (input->size > 0) {
+        input->buffer = mmap(NULL, input->size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+
+    return input->buffer != MAP_FAILED;
+}
+
+// createBuffer create an empty buffer
+void createBuffer(t_buffer *buffer) {
+    buffer->allocated = INPUT_BUFFER_SIZE;
+    buffer->data = malloc(sizeof(char) * buffer->allocated);
+    buffer->size = 0;
+}
+
+// appendBuffer add bytes at the end of a buffer
+void appendBuffer(t_buffer *buffer, char *data, long size) {
+    if (buffer->size + size > buffer->allocated) {
+        while (buffer->size + size > buffer->allocated) {
+            buffer->allocated *= 2;
+        }
+        buffer->data = realloc(buffer->data, sizeof(char) * buffer->allocated);
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+// parseOptions read command line options
+t_boolean parseOptions(int argc, char *argv[], t_options *options) {
+    options->offline = false;
+    options->pipeline = false;
+    options->lookahead = LOOKAHEAD_WINDOW_SIZE;
+    options->snapshot = NULL;
+    options->snapshotFork = false;
+    options->restore = NULL;
+    options->journal = NULL;
+    options->journalCommands = JOURNAL_SYNC_COMMANDS;
+    options->journalInterval = JOURNAL_SYNC_INTERVAL;
+    options->replay = NULL;
+    options->replayIndex = NULL;
+    options->replayInterval = REPLAY_INDEX_INTERVAL;
+    options->seek = -1;
+    options->server = NULL;
+    options->threads = 0;
+    options->readers = 0;
+    options->ring = NULL;
+    options->ringSize = RING_SIZE;
+    options->batch = NULL;
+    options->printThreads = 1;
+    options->trace = NULL;
+    options->memory = false;
+    options->work = false;
+    options->perf = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--offline") == 0) {
+            options->offline = true;
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            options->pipeline = true;
+        } else if (strcmp(argv[i], "--lookahead") == 0 && i + 1 < argc) {
+            i++;
+            options->lookahead = atoi(argv[i]);
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            i++;
+            options->snapshot = argv[i];
+        } else if (strcmp(argv[i], "--snapshot-fork") == 0) {
+            options->snapshotFork = true;
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            i++;
+            options->restore = argv[i];
+        } else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) {
+            i++;
+            options->journal = argv[i];
+        } else if (strcmp(argv[i], "--journal-commands") == 0 && i + 1 < argc) {
+            i++;
+            options->journalCommands = atoi(argv[i]);
+        } else if (strcmp(argv[i], "--journal-interval") == 0 && i + 1 < argc) {
+            i++;
+            options->journalInterval = atoi(argv[i]);
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            i++;
+            options->replay = argv[i];
+        } else if (strcmp(argv[i], "--replay-index") == 0 && i + 1 < argc) {
+            i++;
+            options->replayIndex = argv[i];
+        } else if (strcmp(argv[i], "--replay-interval") == 0 && i + 1 < argc) {
+            i++;
+            options->replayInterval = atoi(argv[i]);
+        } else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+            i++;
+            options->seek = atol(argv[i]);
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            i++;
+            options->server = argv[i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            i++;
+            options->threads = atoi(argv[i]);
+        } else if (strcmp(argv[i], "--readers") == 0 && i + 1 < argc) {
+            i++;
+            options->readers = atoi(argv[i]);
+        } else if (strcmp(argv[i], "--ring") == 0 && i + 1 < argc) {
+            i++;
+            options->ring = argv[i];
+        } else if (strcmp(argv[i], "--ring-size") == 0 && i + 1 < argc) {
+            i++;
+            options->ringSize = atol(argv[i]);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            i++;
+            options->batch = argv[i];
+        } else if (strcmp(argv[i], "--print-threads") == 0 && i + 1 < argc) {
+            i++;
+            options->printThreads = atoi(argv[i]);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            i++;
+            options->trace = argv[i];
+        } else if (strcmp(argv[i], "--memory") == 0) {
+            options->memory = true;
+        } else if (strcmp(argv[i], "--work") == 0) {
+            options->work = true;
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            options->perf = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
 // printLine print a line to stdout
 void printLine(char *line) {
     int i = 0;
+
+    // sessions of the server print to the output of their client
+    if (printBuffer != NULL) {
+        appendBuffer(printBuffer, line, strcspn(line, "\n"));
+        appendBuffer(printBuffer, "\n", 1);
+        return;
+    }
+    // stdout is written by one thread only, the main thread or the render stage of --pipeline
     while (line[i] != '\n' && line[i] != '\0') {
-        putchar(line[i]);
+        putchar_unlocked(line[i]);
         i++;
     }
-    putchar('\n');
-}
-
-// swapText swap text struct
-void swapText(t_text *data1, t_text *data2) {
-    t_text app;
-    app = *data1;
-    *data1 = *data2;
-    *data2 = app;
+    putchar_unlocked('\n');
 }
 
-// getEmptyTextStruct return an empty text struct
-t_text getEmptyTextStruct() {
-    t_text data;
+// getEmptyLinesStruct return an empty lines struct
+t_lines getEmptyLinesStruct() {
+    t_lines data;
     data.lines = NULL;
     data.numLines = 0;
-    data.buffersAllocated = 0;
     return data;
 }
 
 // freeCommand free all area allocated for a command
 void freeCommand(t_command **command) {
-
-    if((*command)->type != 'd') {
-        free((*command)->prevData.lines);
-        (*command)->prevData.lines = NULL;
+    // lines are owned by the text from now on
+    if ((*command)->data.lines != NULL) {
+        COUNT_MEMORY(COMMAND_MEMORY, -(long) (sizeof(char *) * (*command)->data.numLines + 1));
     }
-
+    COUNT_MEMORY(COMMAND_MEMORY, -(long) sizeof(t_command));
     free((*command)->data.lines);
     (*command)->data.lines = NULL;
 
     free((*command));
     (*command) = NULL;
 }
+
+// getTypeIndex return the index of a command type in COMMAND_TYPES, the last one for other types
+int getTypeIndex(char type) {
+    char *found = strchr(COMMAND_TYPES, type);
+    return found != NULL && type != '\0' ? found - COMMAND_TYPES : sizeof(COMMAND_TYPES) - 1;
+}
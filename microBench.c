@@ -0,0 +1,292 @@
+#define _GNU_SOURCE	// to use sched_setaffinity()
+#include <sched.h>
+
+// editor is built in, so its functions are called directly
+#define main runEditor
+#include "main.c"
+#undef main
+
+// #define DEBUG
+
+#define NUM_SAMPLES 1000
+#define NUM_WARMUP 100
+#define OPERATIONS_PER_SAMPLE 10
+#define NUM_EDITS 1024
+#define MAX_SIZES 16
+#define LINE_SIZE 80
+
+typedef struct fixture
+{
+	t_text text;
+	t_history history;
+	// state every operation starts from
+	t_text base;
+	t_history baseHistory;
+	t_lines line;
+	t_input input;
+	t_buffer output;
+	unsigned long long seed;
+} t_fixture;
+
+typedef struct benchmark
+{
+	char *name;
+	void (*run)(t_fixture *);
+} t_benchmark;
+
+void createFixture(t_fixture *, int);
+void executeScript(t_fixture *, char *, long);
+void resetFixture(t_fixture *);
+void benchChange(t_fixture *);
+void benchDelete(t_fixture *);
+void benchPrint(t_fixture *);
+void benchUndo(t_fixture *);
+void benchRedo(t_fixture *);
+void benchCheckout(t_fixture *);
+void benchReadLine(t_fixture *);
+void runBenchmark(const t_benchmark *, t_fixture *, int, int, int);
+int compareSamples(const void *, const void *);
+long getRandomBelow(t_fixture *, long);
+
+const t_benchmark BENCHMARKS[] = {
+	{"changeText", benchChange},
+	{"deleteText", benchDelete},
+	{"printText", benchPrint},
+	{"undo", benchUndo},
+	{"redo", benchRedo},
+	{"checkout", benchCheckout},
+	{"readLine", benchReadLine},
+	{NULL, NULL}
+};
+
+// every benchmark runs on texts of every size, options are --sizes A,B,C --samples N --warmup N --cpu N --filter NAME
+int main(int argc, char *argv[])
+{
+	int sizes[MAX_SIZES] = {1000, 100000, 1000000};
+	int numSizes = 3;
+	int numSamples = NUM_SAMPLES;
+	int numWarmup = NUM_WARMUP;
+	char *filter = NULL;
+	char *size;
+	cpu_set_t cpus;
+	t_fixture fixture;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "--sizes") == 0)
+		{
+			numSizes = 0;
+			for (size = strtok(argv[i + 1], ","); size != NULL && numSizes < MAX_SIZES; size = strtok(NULL, ","))
+				sizes[numSizes++] = atoi(size);
+		}
+		else if (strcmp(argv[i], "--samples") == 0)
+			numSamples = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--warmup") == 0)
+			numWarmup = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--filter") == 0)
+			filter = argv[i + 1];
+		else if (strcmp(argv[i], "--cpu") == 0)
+		{
+			// one core keeps caches warm and the frequency steady between samples
+			CPU_ZERO(&cpus);
+			CPU_SET(atoi(argv[i + 1]), &cpus);
+			if (sched_setaffinity(0, sizeof(cpu_set_t), &cpus) != 0)
+				printf("Unable to pin to cpu %s\n", argv[i + 1]);
+		}
+		else
+		{
+			printf("usage: %s [--sizes A,B,C] [--samples N] [--warmup N] [--cpu N] [--filter NAME]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (numSamples < 1)
+		numSamples = 1;
+
+	printf("%-12s %10s %12s %12s\n", "benchmark", "lines", "median ns", "p99 ns");
+	for (int i = 0; i < numSizes; i++)
+	{
+		createFixture(&fixture, sizes[i]);
+		for (int j = 0; BENCHMARKS[j].name != NULL; j++)
+			if (filter == NULL || strstr(BENCHMARKS[j].name, filter) != NULL)
+				runBenchmark(&BENCHMARKS[j], &fixture, sizes[i], numSamples, numWarmup);
+		// texts are not freed, every size gets its own
+	}
+
+	return 0;
+}
+
+// text of the given lines, with a history of single line edits on top of it
+void createFixture(t_fixture *fixture, int numLines)
+{
+	char *script;
+	long size = 0;
+
+	fixture->seed = 88172645463325252ULL + numLines;
+	createText(&fixture->text);
+	createHistory(&fixture->history);
+
+	script = malloc(sizeof(char) * ((long) (numLines + NUM_EDITS * 3) * LINE_SIZE + MAX_LINE_LENGTH));
+	size += sprintf(script + size, "1,%dc\n", numLines);
+	for (int i = 0; i < numLines; i++)
+		size += sprintf(script + size, "line %d of the benchmark text, long as an average line\n", i);
+	size += sprintf(script + size, ".\n");
+	for (int i = 0; i < NUM_EDITS; i++)
+	{
+		long line = getRandomBelow(fixture, numLines) + 1;
+		size += sprintf(script + size, "%ld,%ldc\nedit %d of the benchmark history\n.\n", line, line, i);
+	}
+	executeScript(fixture, script, size);
+
+	// input of readLine is the script that built the text
+	fixture->input.buffer = script;
+	fixture->input.size = size;
+	fixture->input.offset = 0;
+
+	loadVersion(&fixture->history, &fixture->text);
+	fixture->base = fixture->text;
+	fixture->baseHistory = fixture->history;
+
+	fixture->line.numLines = 1;
+	fixture->line.lines = malloc(sizeof(char *));
+	fixture->line.lines[0] = "line written by the benchmark";
+	createBuffer(&fixture->output);
+}
+
+void executeScript(t_fixture *fixture, char *script, long size)
+{
+	t_input input = {script, size, 0};
+	t_command *command;
+
+	while (input.offset < input.size)
+	{
+		command = readCommand(&input);
+		executeCommand(command, &fixture->text, &fixture->history);
+		updateHistory(&fixture->history, command, &fixture->text);
+	}
+}
+
+// versions are persistent, going back to the base only restores roots and counters
+void resetFixture(t_fixture *fixture)
+{
+	fixture->text = fixture->base;
+	fixture->history.currentVersion = fixture->baseHistory.currentVersion;
+	fixture->history.lastVersion = fixture->baseHistory.lastVersion;
+	fixture->history.textVersion = fixture->baseHistory.textVersion;
+	fixture->history.numPastCommands = fixture->baseHistory.numPastCommands;
+	fixture->history.numFutureCommands = fixture->baseHistory.numFutureCommands;
+	fixture->history.timeTravelMode = fixture->baseHistory.timeTravelMode;
+	fixture->history.numLazyCommands = 0;
+}
+
+void benchChange(t_fixture *fixture)
+{
+	changeText(&fixture->text, fixture->line, getRandomBelow(fixture, fixture->base.numLines) + 1);
+	fixture->text = fixture->base;
+}
+
+void benchDelete(t_fixture *fixture)
+{
+	t_command command;
+
+	command.type = 'd';
+	command.start = getRandomBelow(fixture, fixture->base.numLines) + 1;
+	command.end = command.start;
+	deleteText(&fixture->text, &command);
+	fixture->text = fixture->base;
+}
+
+void benchPrint(t_fixture *fixture)
+{
+	int start = getRandomBelow(fixture, fixture->base.numLines) + 1;
+
+	fixture->output.size = 0;
+	printBuffer = &fixture->output;
+	printText(&fixture->text, start, start + 9 < fixture->base.numLines ? start + 9 : fixture->base.numLines);
+	printBuffer = NULL;
+}
+
+// any number of edits back, the version is built from its nearest checkpoint
+void benchUndo(t_fixture *fixture)
+{
+	t_command command;
+
+	command.type = 'u';
+	command.start = getRandomBelow(fixture, NUM_EDITS) + 1;
+	undoCommand(&command, &fixture->text, &fixture->history);
+	loadVersion(&fixture->history, &fixture->text);
+	resetFixture(fixture);
+}
+
+void benchRedo(t_fixture *fixture)
+{
+	t_command command;
+
+	command.type = 'u';
+	command.start = NUM_EDITS;
+	undoCommand(&command, &fixture->text, &fixture->history);
+	command.type = 'r';
+	command.start = getRandomBelow(fixture, NUM_EDITS) + 1;
+	redoCommand(&command, &fixture->text, &fixture->history);
+	loadVersion(&fixture->history, &fixture->text);
+	resetFixture(fixture);
+}
+
+void benchCheckout(t_fixture *fixture)
+{
+	t_command command;
+
+	command.type = 'v';
+	command.start = getRandomBelow(fixture, fixture->history.numVersions);
+	checkoutCommand(&command, &fixture->text, &fixture->history);
+	loadVersion(&fixture->history, &fixture->text);
+	resetFixture(fixture);
+}
+
+void benchReadLine(t_fixture *fixture)
+{
+	if (fixture->input.offset >= fixture->input.size)
+		fixture->input.offset = 0;
+	free(readLine(&fixture->input));
+}
+
+// samples time a few operations each, the first ones only warm caches and allocator up
+void runBenchmark(const t_benchmark *benchmark, t_fixture *fixture, int numLines, int numSamples, int numWarmup)
+{
+	long *samples = malloc(sizeof(long) * numSamples);
+	long start;
+
+	for (int i = 0; i < numWarmup + numSamples; i++)
+	{
+		start = getTimeNanos();
+		for (int j = 0; j < OPERATIONS_PER_SAMPLE; j++)
+			benchmark->run(fixture);
+		if (i >= numWarmup)
+			samples[i - numWarmup] = (getTimeNanos() - start) / OPERATIONS_PER_SAMPLE;
+	}
+
+	qsort(samples, numSamples, sizeof(long), compareSamples);
+	printf("%-12s %10d %12ld %12ld\n", benchmark->name, numLines, samples[numSamples / 2], samples[(numSamples - 1) * 99 / 100]);
+	fflush(stdout);
+
+	#ifdef DEBUG
+		printf("min %ld ns, max %ld ns\n", samples[0], samples[numSamples - 1]);
+	#endif
+
+	free(samples);
+}
+
+int compareSamples(const void *first, const void *second)
+{
+	long a = *(long *) first;
+	long b = *(long *) second;
+	return (a > b) - (a < b);
+}
+
+// xorshift, the same operations for every run
+long getRandomBelow(t_fixture *fixture, long bound)
+{
+	fixture->seed ^= fixture->seed << 13;
+	fixture->seed ^= fixture->seed >> 7;
+	fixture->seed ^= fixture->seed << 17;
+	return bound > 0 ? (long) (fixture->seed % bound) : 0;
+}
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>	// to use fork()
+#include <signal.h>	// to use kill()
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// #define DEBUG
+
+#define BUILD_FILE "./main.out"
+#define SOCKET_PATH "/tmp/serverBench.sock"
+#define MAX_STRING_SIZE 1000
+#define MAX_THREADS 8
+#define NUM_SESSIONS 64
+#define NUM_COMMANDS 400000
+// a print every few edits, and an undo and redo now and then
+#define PRINT_EVERY 8
+#define UNDO_EVERY 50
+#define MAX_LINES 1000
+#define CHUNK_SIZE 65536
+
+typedef enum boolean { false, true } t_boolean;
+
+typedef struct client
+{
+	int socket;
+	char *script;
+	long size;
+	long sent;
+	int numCommands;
+	t_boolean done;
+} t_client;
+
+pid_t startServer(int);
+int connectServer();
+void buildScript(t_client *, int, unsigned int);
+long runClients(t_client *, int);
+long getTimeMillis();
+
+// server is run with 1, 2, 4... threads on the same sessions, session i gets commands in proportion to 1 / (i + 1)
+int main(int argc, char *argv[])
+{
+	int maxThreads = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+	int numSessions = argc > 2 ? atoi(argv[2]) : NUM_SESSIONS;
+	long numCommands = argc > 3 ? atol(argv[3]) : NUM_COMMANDS;
+	t_client *clients;
+	double harmonic = 0;
+	double baseline = 0;
+	double throughput;
+	long total;
+	long elapsed;
+	pid_t server;
+
+	for (int i = 0; i < numSessions; i++)
+		harmonic += 1.0 / (i + 1);
+
+	clients = malloc(sizeof(t_client) * numSessions);
+	for (int threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		server = startServer(threads);
+		if (server < 0)
+		{
+			puts("Unable to start server");
+			return 1;
+		}
+
+		total = 0;
+		for (int i = 0; i < numSessions; i++)
+		{
+			buildScript(&clients[i], numCommands / harmonic / (i + 1) + 1, i + 1);
+			clients[i].socket = connectServer();
+			total += clients[i].numCommands;
+		}
+
+		elapsed = runClients(clients, numSessions);
+		throughput = total * 1000.0 / (elapsed > 0 ? elapsed : 1);
+		if (threads == 1)
+			baseline = throughput;
+		printf("threads %d: %ld commands in %ld ms, %.0f commands/s, speedup %.2f\n", threads, total, elapsed, throughput, throughput / baseline);
+
+		for (int i = 0; i < numSessions; i++)
+		{
+			close(clients[i].socket);
+			free(clients[i].script);
+		}
+		kill(server, SIGTERM);
+		waitpid(server, NULL, 0);
+	}
+
+	unlink(SOCKET_PATH);
+	return 0;
+}
+
+pid_t startServer(int threads)
+{
+	char threadsString[MAX_STRING_SIZE];
+	pid_t server;
+	int client;
+
+	unlink(SOCKET_PATH);
+	sprintf(threadsString, "%d", threads);
+	server = fork();
+	if (server == 0)
+	{
+		execl(BUILD_FILE, BUILD_FILE, "--server", SOCKET_PATH, "--threads", threadsString, (char *) NULL);
+		exit(1);
+	}
+
+	// server is ready when it accepts a client
+	for (int i = 0; i < 500; i++)
+	{
+		if (access(SOCKET_PATH, F_OK) == 0)
+		{
+			client = connectServer();
+			if (client >= 0)
+			{
+				close(client);
+				return server;
+			}
+		}
+		usleep(10000);
+	}
+	kill(server, SIGTERM);
+	return -1;
+}
+
+int connectServer()
+{
+	struct sockaddr_un address;
+	int client;
+
+	client = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&address, 0, sizeof(struct sockaddr_un));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, SOCKET_PATH);
+	if (connect(client, (struct sockaddr *) &address, sizeof(struct sockaddr_un)) != 0)
+	{
+		close(client);
+		return -1;
+	}
+	fcntl(client, F_SETFL, O_NONBLOCK);
+	return client;
+}
+
+void buildScript(t_client *client, int numCommands, unsigned int seed)
+{
+	long allocated = MAX_STRING_SIZE;
+	int numLines = 0;
+	int line;
+
+	client->script = malloc(sizeof(char) * allocated);
+	client->size = 0;
+	client->sent = 0;
+	client->numCommands = numCommands;
+	client->done = false;
+
+	for (int i = 0; i < numCommands; i++)
+	{
+		if (allocated - client->size < MAX_STRING_SIZE)
+		{
+			allocated *= 2;
+			client->script = realloc(client->script, sizeof(char) * allocated);
+		}
+
+		seed = seed * 1103515245 + 12345;
+		if (i % PRINT_EVERY == PRINT_EVERY - 1)
+			client->size += sprintf(client->script + client->size, "1,20p\n");
+		else if (i % UNDO_EVERY == UNDO_EVERY - 1)
+			client->size += sprintf(client->script + client->size, "1r\n");
+		else if (i % UNDO_EVERY == UNDO_EVERY - 2)
+			client->size += sprintf(client->script + client->size, "1u\n");
+		else
+		{
+			line = numLines < MAX_LINES ? (seed >> 16) % (numLines + 1) + 1 : (seed >> 16) % numLines + 1;
+			if (line > numLines)
+				numLines = line;
+			client->size += sprintf(client->script + client->size, "%d,%dc\nline %d of command %d\n.\n", line, line, line, i);
+		}
+	}
+	client->size += sprintf(client->script + client->size, "q\n");
+
+	#ifdef DEBUG
+		printf("Session of %d commands, %ld bytes\n", numCommands, client->size);
+	#endif
+}
+
+// send every script and read outputs until the server closes every session
+long runClients(t_client *clients, int numClients)
+{
+	struct pollfd *polls;
+	char buffer[CHUNK_SIZE];
+	long start = getTimeMillis();
+	long size;
+	int numDone = 0;
+
+	polls = malloc(sizeof(struct pollfd) * numClients);
+	while (numDone < numClients)
+	{
+		for (int i = 0; i < numClients; i++)
+		{
+			polls[i].fd = clients[i].done == true ? -1 : clients[i].socket;
+			polls[i].events = POLLIN;
+			if (clients[i].sent < clients[i].size)
+				polls[i].events |= POLLOUT;
+		}
+		poll(polls, numClients, -1);
+
+		for (int i = 0; i < numClients; i++)
+		{
+			if (polls[i].revents & POLLOUT)
+			{
+				size = write(clients[i].socket, clients[i].script + clients[i].sent, clients[i].size - clients[i].sent < CHUNK_SIZE ? clients[i].size - clients[i].sent : CHUNK_SIZE);
+				if (size > 0)
+					clients[i].sent += size;
+			}
+			if (polls[i].revents & (POLLIN | POLLHUP))
+			{
+				size = read(clients[i].socket, buffer, CHUNK_SIZE);
+				// server closes the session after quit
+				if (size == 0)
+				{
+					clients[i].done = true;
+					numDone++;
+				}
+			}
+		}
+	}
+	free(polls);
+
+	return getTimeMillis() - start;
+}
+
+long getTimeMillis()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
@@ -2,6 +2,17 @@
 #include <stdlib.h>	// to use system()
 #include <string.h> // to use strcpy()
 #include <dirent.h> // to use opendir()
+#include <unistd.h> // to use rmdir()
+#include <signal.h> // to use kill()
+#include <sys/wait.h> // to use waitpid()
+#include <sys/socket.h> // to use connect()
+#include <sys/un.h> // to use sockaddr_un
+#include <sys/mman.h> // to use mmap()
+#include <sys/syscall.h> // to use syscall()
+#include <linux/futex.h> // to use FUTEX_WAIT
+#include <limits.h> // to use INT_MAX
+#include <time.h> // to use timespec
+#include <fcntl.h> // to use open()
 
 // #define DEBUG
 
@@ -10,6 +21,9 @@
 #define MAX_STRING_SIZE 1000
 #define MAX_ARRAY_SIZE 1000
 
+// every test is executed once for each executor mode
+const char *EXECUTOR_MODES[] = {"", " --lookahead 0", " --offline", " --print-threads 2", " --pipeline", NULL};
+
 typedef enum boolean { false, true } t_boolean;
 
 typedef struct text
@@ -18,7 +32,81 @@ typedef struct text
 	int len;
 } t_text;
 
-void executeTest(char *, char *, char *, char *);
+// layout of a ring file of the editor, see Ring in the readme
+#define RING_HEADER_SIZE 4096
+
+typedef struct ring
+{
+	unsigned int head;
+	unsigned int tail;
+	unsigned int events;
+	int readerWaiting;
+	int writerWaiting;
+} t_ring;
+
+typedef struct ringFile
+{
+	char magic[8];
+	unsigned int size;
+	int closed;
+	t_ring commands;
+	t_ring prints;
+} t_ringFile;
+
+// a session is stopped halfway and a second session goes on from what the first one left
+typedef struct recovery
+{
+	const char *name;
+	// options of both sessions, %1$s is the scratch folder
+	const char *firstOptions;
+	const char *secondOptions;
+	// commands added to the first session after a quarter and at the end of its half
+	const char *middle;
+	const char *end;
+	// a record cut by a crash is appended to the journal before the second session
+	t_boolean tearJournal;
+} t_recovery;
+
+// every test is also run in two sessions for each recovery mode
+const t_recovery RECOVERY_MODES[] = {
+	{"journal", " --journal %1$s/journal", " --journal %1$s/journal", "", "", true},
+	{"journal sync", " --journal %1$s/journal --journal-commands 1", " --journal %1$s/journal --journal-commands 1", "", "", true},
+	{"snapshot", " --snapshot %1$s/snapshot", " --restore %1$s/snapshot", "", "s\n", false},
+	{"snapshot journal", " --journal %1$s/journal --snapshot %1$s/snapshot", " --journal %1$s/journal --restore %1$s/snapshot", "s\n", "", true},
+	{"snapshot fork", " --journal %1$s/journal --snapshot %1$s/snapshot --snapshot-fork", " --journal %1$s/journal --restore %1$s/snapshot", "s\n", "", true},
+	{NULL}
+};
+
+// commands of a journal after which its text is printed, the index has a point every few of them
+#define SEEK_INTERVAL 4
+const int SEEK_TARGETS[] = {0, 1, SEEK_INTERVAL - 1, SEEK_INTERVAL, SEEK_INTERVAL + 1, -1};
+
+// every test is also sent by a client of a server, all clients at once, for each server mode
+const char *SERVER_MODES[] = {" --threads 1", " --threads 4", " --threads 2 --readers 2", NULL};
+
+// every test is also sent through the rings of a ring file, a small ring wraps and fills up
+const char *RING_MODES[] = {" --ring-size 4096", NULL};
+
+// all tests are also run as one batch, on a pool of threads
+#define BATCH_OPTIONS " --threads 2"
+
+void executeTest(char *, char *, char *, char *, const char *);
+void executeRecoveryTest(char *, char *, char *, char *, const t_recovery *);
+void executeSeekTest(char *, char *, char *);
+void executeSeek(char *, char *, t_text, int, int);
+void removeFinalDots(char *);
+void executeServerTests(t_text, char *, const char *);
+int connectClient(char *, char *);
+void readClient(int, char *);
+void executeRingTest(char *, char *, char *, char *, const char *);
+void executeBatchTests(t_text, char *);
+char *mapRing(int, long, unsigned int);
+void writeRing(t_ring *, char *, unsigned int, char *, long);
+void waitRing(unsigned int *, unsigned int, int *);
+void wakeRing(unsigned int *, int *);
+t_text readCommands(char *);
+void writeCommands(char *, t_text, int, int, const char *);
+void tearJournal(char *);
 t_text getTestFolders();
 t_boolean isDir(char *);
 char *concatFoldersPath(char *, char *);
@@ -28,7 +116,7 @@ char *getInputPath(char *);
 char *getOutputPath(char *);
 char *getResultPath(char *);
 
-void executeTest(char *testName, char *inputPath, char *outputPath, char *resultPath)
+void executeTest(char *testName, char *inputPath, char *outputPath, char *resultPath, const char *mode)
 {
 	char *command;
 
@@ -39,8 +127,11 @@ void executeTest(char *testName, char *inputPath, char *outputPath, char *result
 	strcat(command, inputPath);
 	strcat(command,  " | ");
 	strcat(command, BUILD_FILE);
+	strcat(command, mode);
 	strcat(command,  " > ");
 	strcat(command,  resultPath);
+	// some modes report on stderr, such as the queues of the pipeline
+	strcat(command,  " 2> /dev/null");
 
 	system(command);
 
@@ -51,11 +142,620 @@ void executeTest(char *testName, char *inputPath, char *outputPath, char *result
 	strcat(command, outputPath);
 	strcat(command, " || echo \'----- ERROR IN ");
 	strcat(command, testName);
+	strcat(command, mode);
 	strcat(command, " -----\'");
 
 	system(command);
 }
 
+void executeRecoveryTest(char *testName, char *inputPath, char *outputPath, char *scratch, const t_recovery *recovery)
+{
+	char *command;
+	char *path;
+	char *firstOptions;
+	char *secondOptions;
+	t_text commands;
+	int half;
+
+	command = malloc(sizeof(char) * MAX_STRING_SIZE);
+	path = malloc(sizeof(char) * MAX_STRING_SIZE);
+	firstOptions = malloc(sizeof(char) * MAX_STRING_SIZE);
+	secondOptions = malloc(sizeof(char) * MAX_STRING_SIZE);
+
+	sprintf(firstOptions, recovery -> firstOptions, scratch);
+	sprintf(secondOptions, recovery -> secondOptions, scratch);
+	sprintf(command, "rm -f %s/*", scratch);
+	system(command);
+
+	// first session runs half of the commands, the second one the rest
+	commands = readCommands(inputPath);
+	half = commands.len / 2;
+	sprintf(path, "%s/first.txt", scratch);
+	writeCommands(path, commands, 0, half / 2, recovery -> middle);
+	writeCommands(path, commands, half / 2, half, recovery -> end);
+	writeCommands(path, commands, 0, 0, "q\n");
+	sprintf(path, "%s/second.txt", scratch);
+	writeCommands(path, commands, half, commands.len, "q\n");
+
+	// checkpoints report their size on stderr
+	sprintf(command, "cat %1$s/first.txt | %2$s%3$s > %1$s/result.txt 2> /dev/null", scratch, BUILD_FILE, firstOptions);
+	system(command);
+	if(recovery -> tearJournal)
+	{
+		sprintf(path, "%s/journal", scratch);
+		tearJournal(path);
+	}
+	sprintf(command, "cat %1$s/second.txt | %2$s%3$s >> %1$s/result.txt", scratch, BUILD_FILE, secondOptions);
+	system(command);
+
+	sprintf(command, "cmp --silent %s/result.txt %s || echo '----- ERROR IN %s %s -----'", scratch, outputPath, testName, recovery -> name);
+	system(command);
+
+	for(int i = 0; i < commands.len; i++)
+	{
+		free(commands.data[i]);
+	}
+	free(commands.data);
+	free(command);
+	free(path);
+	free(firstOptions);
+	free(secondOptions);
+}
+
+void executeSeekTest(char *testName, char *inputPath, char *scratch)
+{
+	char *command;
+	char *path;
+	t_text commands;
+	t_text journaled;
+	t_text rewritten;
+	int numLines = 0;
+	int half;
+	char type;
+
+	command = malloc(sizeof(char) * MAX_STRING_SIZE);
+	path = malloc(sizeof(char) * MAX_STRING_SIZE);
+
+	sprintf(command, "rm -f %s/*", scratch);
+	system(command);
+
+	// prints are not journaled, seeking counts only the other commands
+	commands = readCommands(inputPath);
+	half = commands.len / 2;
+	journaled.data = malloc(sizeof(char *) * (commands.len + 1));
+	journaled.len = 0;
+	rewritten.len = 0;
+	for(int i = 0; i < commands.len; i++)
+	{
+		if(i == half)
+		{
+			rewritten.len = journaled.len;
+		}
+		type = commands.data[i][strcspn(commands.data[i], "\n") - 1];
+		if(type != 'p' && type != 'h' && type != 's')
+		{
+			journaled.data[journaled.len] = commands.data[i];
+			journaled.len++;
+		}
+		for(char *c = commands.data[i]; *c != '\0'; c++)
+		{
+			numLines += *c == '\n';
+		}
+	}
+
+	// the index is made on half of the journal and extended with the rest
+	sprintf(path, "%s/first.txt", scratch);
+	writeCommands(path, commands, 0, half, "q\n");
+	sprintf(path, "%s/second.txt", scratch);
+	writeCommands(path, commands, half, commands.len, "q\n");
+	sprintf(command, "cat %1$s/first.txt | %2$s --journal %1$s/journal > /dev/null", scratch, BUILD_FILE);
+	system(command);
+	sprintf(command, "%2$s --replay %1$s/journal --replay-interval %3$d 2> /dev/null", scratch, BUILD_FILE, SEEK_INTERVAL);
+	system(command);
+	sprintf(command, "cat %1$s/second.txt | %2$s --journal %1$s/journal > /dev/null", scratch, BUILD_FILE);
+	system(command);
+
+	for(int i = 0; SEEK_TARGETS[i] >= 0; i++)
+	{
+		if(SEEK_TARGETS[i] <= journaled.len)
+		{
+			executeSeek(testName, scratch, journaled, SEEK_TARGETS[i], numLines);
+		}
+	}
+	executeSeek(testName, scratch, journaled, journaled.len / 2, numLines);
+	executeSeek(testName, scratch, journaled, journaled.len, numLines);
+
+	// a journal rewritten with its halves swapped has the same size but does not match the index any more
+	sprintf(path, "%s/swapped.txt", scratch);
+	writeCommands(path, commands, half, commands.len, "");
+	writeCommands(path, commands, 0, half, "q\n");
+	sprintf(command, "rm %1$s/journal && cat %1$s/swapped.txt | %2$s --journal %1$s/journal > /dev/null", scratch, BUILD_FILE);
+	system(command);
+	rewritten.data = malloc(sizeof(char *) * (journaled.len + 1));
+	memcpy(rewritten.data, journaled.data + rewritten.len, sizeof(char *) * (journaled.len - rewritten.len));
+	memcpy(rewritten.data + journaled.len - rewritten.len, journaled.data, sizeof(char *) * rewritten.len);
+	rewritten.len = journaled.len;
+	executeSeek(testName, scratch, rewritten, rewritten.len, numLines);
+	free(rewritten.data);
+
+	for(int i = 0; i < commands.len; i++)
+	{
+		free(commands.data[i]);
+	}
+	free(commands.data);
+	free(journaled.data);
+	free(command);
+	free(path);
+}
+
+// executeSeek compare the text after a command of the journal with the text of a session that stops there
+void executeSeek(char *testName, char *scratch, t_text journaled, int target, int numLines)
+{
+	char *command;
+	char *path;
+	char *print;
+
+	command = malloc(sizeof(char) * MAX_STRING_SIZE);
+	path = malloc(sizeof(char) * MAX_STRING_SIZE);
+	print = malloc(sizeof(char) * MAX_STRING_SIZE);
+
+	sprintf(command, "%2$s --replay %1$s/journal --replay-interval %3$d --seek %4$d > %1$s/result.txt 2> /dev/null", scratch, BUILD_FILE, SEEK_INTERVAL, target);
+	system(command);
+
+	// the whole text is printed with dots after it, as many as the lines that were never written
+	sprintf(path, "%s/expected.txt", scratch);
+	remove(path);
+	sprintf(print, "1,%dp\nq\n", numLines > 0 ? numLines : 1);
+	writeCommands(path, journaled, 0, target, print);
+	sprintf(command, "cat %1$s/expected.txt | %2$s > %1$s/expectedResult.txt", scratch, BUILD_FILE);
+	system(command);
+
+	sprintf(path, "%s/result.txt", scratch);
+	removeFinalDots(path);
+	sprintf(path, "%s/expectedResult.txt", scratch);
+	removeFinalDots(path);
+	sprintf(command, "cmp --silent %1$s/result.txt %1$s/expectedResult.txt || echo '----- ERROR IN %2$s seek %3$d -----'", scratch, testName, target);
+	system(command);
+
+	free(command);
+	free(path);
+	free(print);
+}
+
+// removeFinalDots remove the lines made of a dot at the end of a file
+void removeFinalDots(char *path)
+{
+	FILE *file;
+	char *content;
+	long size;
+
+	file = fopen(path, "r");
+	if(file == NULL)
+	{
+		return;
+	}
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	content = malloc(sizeof(char) * (size + 1));
+	size = fread(content, sizeof(char), size, file);
+	fclose(file);
+
+	while(size >= 2 && content[size - 2] == '.' && content[size - 1] == '\n' && (size == 2 || content[size - 3] == '\n'))
+	{
+		size -= 2;
+	}
+
+	file = fopen(path, "w");
+	if(file != NULL)
+	{
+		fwrite(content, sizeof(char), size, file);
+		fclose(file);
+	}
+	free(content);
+}
+
+void executeServerTests(t_text folders, char *scratch, const char *mode)
+{
+	char *command;
+	char *socketPath;
+	char *resultPath;
+	int *clients;
+	pid_t server;
+
+	command = malloc(sizeof(char) * MAX_STRING_SIZE);
+	socketPath = malloc(sizeof(char) * MAX_STRING_SIZE);
+	resultPath = malloc(sizeof(char) * MAX_STRING_SIZE);
+	clients = malloc(sizeof(int) * folders.len);
+
+	sprintf(command, "rm -f %s/*", scratch);
+	system(command);
+	sprintf(socketPath, "%s/socket", scratch);
+	sprintf(resultPath, "%s/result.txt", scratch);
+	sprintf(command, "exec %s --server %s%s", BUILD_FILE, socketPath, mode);
+	server = fork();
+	if(server == 0)
+	{
+		execl("/bin/sh", "sh", "-c", command, NULL);
+		_exit(1);
+	}
+
+	// the socket appears once the server listens
+	for(int i = 0; i < 500 && access(socketPath, F_OK) != 0; i++)
+	{
+		usleep(10000);
+	}
+
+	// sessions run together, each client reads its output once it has sent its input
+	for(int i = 0; i < folders.len; i++)
+	{
+		clients[i] = connectClient(socketPath, getInputPath(folders.data[i]));
+	}
+	for(int i = 0; i < folders.len; i++)
+	{
+		readClient(clients[i], resultPath);
+		sprintf(command, "cmp --silent %s %s || echo '----- ERROR IN %s server%s -----'", resultPath, getOutputPath(folders.data[i]), folders.data[i], mode);
+		system(command);
+	}
+
+	kill(server, SIGKILL);
+	waitpid(server, NULL, 0);
+
+	free(command);
+	free(socketPath);
+	free(resultPath);
+	free(clients);
+}
+
+// connectClient open a connection to the server and send it a whole input, -1 when it cannot connect
+int connectClient(char *socketPath, char *inputPath)
+{
+	struct sockaddr_un address;
+	FILE *input;
+	char buffer[MAX_STRING_SIZE];
+	long size;
+	int client;
+
+	client = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&address, 0, sizeof(struct sockaddr_un));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+	if(client < 0 || connect(client, (struct sockaddr *) &address, sizeof(struct sockaddr_un)) != 0)
+	{
+		return -1;
+	}
+
+	input = fopen(inputPath, "r");
+	if(input != NULL)
+	{
+		while((size = fread(buffer, sizeof(char), MAX_STRING_SIZE, input)) > 0)
+		{
+			write(client, buffer, size);
+		}
+		fclose(input);
+	}
+
+	// server sees the end of the input even without a quit
+	shutdown(client, SHUT_WR);
+	return client;
+}
+
+// readClient write what the server sends to a client until it closes the connection
+void readClient(int client, char *resultPath)
+{
+	FILE *result;
+	char buffer[MAX_STRING_SIZE];
+	long size;
+
+	result = fopen(resultPath, "w");
+	if(result == NULL)
+	{
+		return;
+	}
+	while(client >= 0 && (size = read(client, buffer, MAX_STRING_SIZE)) > 0)
+	{
+		fwrite(buffer, sizeof(char), size, result);
+	}
+	fclose(result);
+	close(client);
+}
+
+void executeRingTest(char *testName, char *inputPath, char *outputPath, char *scratch, const char *mode)
+{
+	char *command;
+	char *ringPath;
+	char *resultPath;
+	char *input;
+	char *commands;
+	char *prints;
+	FILE *file;
+	FILE *result;
+	t_ringFile *ring;
+	unsigned int size;
+	unsigned int head;
+	unsigned int events;
+	long length = 0;
+	int descriptor = -1;
+	int numWaits = 0;
+	pid_t editor;
+	pid_t writer;
+
+	command = malloc(sizeof(char) * MAX_STRING_SIZE);
+	ringPath = malloc(sizeof(char) * MAX_STRING_SIZE);
+	resultPath = malloc(sizeof(char) * MAX_STRING_SIZE);
+
+	sprintf(ringPath, "%s/ring", scratch);
+	sprintf(resultPath, "%s/result.txt", scratch);
+	remove(ringPath);
+	sprintf(command, "exec %s --ring %s%s", BUILD_FILE, ringPath, mode);
+	editor = fork();
+	if(editor == 0)
+	{
+		execl("/bin/sh", "sh", "-c", command, NULL);
+		_exit(1);
+	}
+
+	// the file appears under its name once it is ready
+	for(int i = 0; i < 500 && (descriptor = open(ringPath, O_RDWR)) < 0; i++)
+	{
+		usleep(10000);
+	}
+	file = fopen(inputPath, "r");
+	result = fopen(resultPath, "w");
+	if(descriptor >= 0 && file != NULL && result != NULL)
+	{
+		fseek(file, 0, SEEK_END);
+		length = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		input = malloc(sizeof(char) * (length + 1));
+		length = fread(input, sizeof(char), length, file);
+
+		ring = mmap(NULL, RING_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+		size = ring -> size;
+		commands = mapRing(descriptor, RING_HEADER_SIZE, size);
+		prints = mapRing(descriptor, RING_HEADER_SIZE + size, size);
+
+		// commands are written by another process while prints are read, so neither ring stays full
+		writer = fork();
+		if(writer == 0)
+		{
+			writeRing(&ring -> commands, commands, size, input, length);
+			_exit(0);
+		}
+		while(true)
+		{
+			events = __atomic_load_n(&ring -> prints.events, __ATOMIC_ACQUIRE);
+			head = __atomic_load_n(&ring -> prints.head, __ATOMIC_ACQUIRE);
+			if(head != ring -> prints.tail)
+			{
+				fwrite(prints + (ring -> prints.tail & (size - 1)), sizeof(char), head - ring -> prints.tail, result);
+				__atomic_store_n(&ring -> prints.tail, head, __ATOMIC_SEQ_CST);
+				wakeRing(&ring -> prints.tail, &ring -> prints.writerWaiting);
+				numWaits = 0;
+				continue;
+			}
+			// an editor that died or is stuck for ten seconds never closes the ring
+			if(__atomic_load_n(&ring -> closed, __ATOMIC_ACQUIRE) == 1 || waitpid(editor, NULL, WNOHANG) == editor || numWaits == 100)
+			{
+				break;
+			}
+			waitRing(&ring -> prints.events, events, &ring -> prints.readerWaiting);
+			numWaits++;
+		}
+		kill(writer, SIGKILL);
+		waitpid(writer, NULL, 0);
+		free(input);
+	}
+	if(file != NULL)
+	{
+		fclose(file);
+	}
+	if(result != NULL)
+	{
+		fclose(result);
+	}
+	if(descriptor >= 0)
+	{
+		close(descriptor);
+	}
+	kill(editor, SIGKILL);
+	waitpid(editor, NULL, 0);
+
+	sprintf(command, "cmp --silent %s %s || echo '----- ERROR IN %s ring%s -----'", resultPath, outputPath, testName, mode);
+	system(command);
+
+	free(command);
+	free(ringPath);
+	free(resultPath);
+}
+
+void executeBatchTests(t_text folders, char *scratch)
+{
+	char *command;
+	char *path;
+	FILE *list;
+
+	command = malloc(sizeof(char) * MAX_STRING_SIZE);
+	path = malloc(sizeof(char) * MAX_STRING_SIZE);
+
+	sprintf(command, "rm -f %s/*", scratch);
+	system(command);
+
+	// every input of the list has its output in the scratch folder
+	sprintf(path, "%s/list.txt", scratch);
+	list = fopen(path, "w");
+	if(list == NULL)
+	{
+		free(command);
+		free(path);
+		return;
+	}
+	for(int i = 0; i < folders.len; i++)
+	{
+		fprintf(list, "%s %s/result%d.txt\n", getInputPath(folders.data[i]), scratch, i);
+	}
+	fclose(list);
+
+	sprintf(command, "%s --batch %s%s", BUILD_FILE, path, BATCH_OPTIONS);
+	system(command);
+
+	for(int i = 0; i < folders.len; i++)
+	{
+		sprintf(command, "cmp --silent %s/result%d.txt %s || echo '----- ERROR IN %s batch%s -----'", scratch, i, getOutputPath(folders.data[i]), folders.data[i], BATCH_OPTIONS);
+		system(command);
+	}
+
+	free(command);
+	free(path);
+}
+
+// mapRing map the data of a ring twice in a row, so bytes across its end are contiguous
+char *mapRing(int descriptor, long offset, unsigned int size)
+{
+	char *data;
+
+	data = mmap(NULL, 2L * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	mmap(data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, descriptor, offset);
+	mmap(data + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, descriptor, offset);
+	return data;
+}
+
+// writeRing copy bytes to a ring in small writes, waiting for the editor when it is full
+void writeRing(t_ring *ring, char *data, unsigned int size, char *source, long length)
+{
+	unsigned int tail;
+	long space;
+	long count;
+
+	while(length > 0)
+	{
+		tail = __atomic_load_n(&ring -> tail, __ATOMIC_ACQUIRE);
+		space = size - (ring -> head - tail);
+		if(space == 0)
+		{
+			waitRing(&ring -> tail, tail, &ring -> writerWaiting);
+			continue;
+		}
+		// commands are often split between writes
+		count = length < space ? length : space;
+		count = count < 100 ? count : 100;
+		memcpy(data + (ring -> head & (size - 1)), source, count);
+		__atomic_store_n(&ring -> head, ring -> head + count, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&ring -> events, 1, __ATOMIC_SEQ_CST);
+		wakeRing(&ring -> events, &ring -> readerWaiting);
+		source += count;
+		length -= count;
+	}
+}
+
+// waitRing sleep while a counter of a ring keeps the given value, for a while at most
+void waitRing(unsigned int *counter, unsigned int value, int *waiting)
+{
+	struct timespec timeout = {0, 100000000};
+
+	__atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(counter, __ATOMIC_SEQ_CST) == value)
+	{
+		syscall(SYS_futex, counter, FUTEX_WAIT, value, &timeout, NULL, 0);
+	}
+	__atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+// wakeRing wake the editor when it sleeps on a counter
+void wakeRing(unsigned int *counter, int *waiting)
+{
+	if(__atomic_load_n(waiting, __ATOMIC_SEQ_CST) == 1)
+	{
+		syscall(SYS_futex, counter, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+// readCommands split the commands of an input before its first quit, every command with its lines
+t_text readCommands(char *inputPath)
+{
+	FILE *input;
+	t_text commands;
+	char line[MAX_STRING_SIZE];
+	char *command;
+	int allocated = MAX_ARRAY_SIZE;
+	int length;
+
+	commands.data = malloc(sizeof(char *) * allocated);
+	commands.len = 0;
+
+	input = fopen(inputPath, "r");
+	if(input == NULL)
+	{
+		return commands;
+	}
+
+	while(fgets(line, MAX_STRING_SIZE, input) != NULL && strcmp(line, "q\n") != 0)
+	{
+		command = malloc(sizeof(char) * (strlen(line) + 1));
+		strcpy(command, line);
+		length = strlen(line);
+
+		// a change is followed by its lines and a dot
+		if(length >= 2 && line[length - 2] == 'c')
+		{
+			while(fgets(line, MAX_STRING_SIZE, input) != NULL)
+			{
+				command = realloc(command, sizeof(char) * (strlen(command) + strlen(line) + 1));
+				strcat(command, line);
+				if(strcmp(line, ".\n") == 0)
+				{
+					break;
+				}
+			}
+		}
+
+		if(commands.len == allocated)
+		{
+			allocated *= 2;
+			commands.data = realloc(commands.data, sizeof(char *) * allocated);
+		}
+		commands.data[commands.len] = command;
+		commands.len++;
+	}
+
+	fclose(input);
+	return commands;
+}
+
+// writeCommands append the commands from first to last, excluded, and then the given tail
+void writeCommands(char *path, t_text commands, int first, int last, const char *tail)
+{
+	FILE *output;
+
+	output = fopen(path, "a");
+	if(output == NULL)
+	{
+		return;
+	}
+	for(int i = first; i < last; i++)
+	{
+		fputs(commands.data[i], output);
+	}
+	fputs(tail, output);
+	fclose(output);
+}
+
+// tearJournal append the beginning of a record longer than the rest of the journal
+void tearJournal(char *path)
+{
+	FILE *journal;
+	unsigned int header[2] = {1000, 0};
+
+	journal = fopen(path, "ab");
+	if(journal == NULL)
+	{
+		return;
+	}
+	fwrite(header, sizeof(unsigned int), 2, journal);
+	fputs("1,1c\nlost", journal);
+	fclose(journal);
+}
+
 
 t_text getTestFolders()
 {
@@ -220,6 +920,15 @@ char *getResultPath(char *folder)
 int main()
 {
 	t_text folders = getTestFolders();
+	char scratch[] = "/tmp/testsXXXXXX";
+	char command[MAX_STRING_SIZE];
+
+	// journals and snapshots of recovery tests
+	if(mkdtemp(scratch) == NULL)
+	{
+		puts("Unable to create scratch directory");
+		return 1;
+	}
 
 	if(folders.len == 0)
 	{
@@ -235,14 +944,36 @@ int main()
 				printf("Output path %s\n", getOutputPath(folders.data[i]));
 				printf("Result path %s\n", getResultPath(folders.data[i]));
 			#endif
-			executeTest(folders.data[i], getInputPath(folders.data[i]), getOutputPath(folders.data[i]), getResultPath(folders.data[i]));
+			for(int j = 0; EXECUTOR_MODES[j] != NULL; j++)
+			{
+				executeTest(folders.data[i], getInputPath(folders.data[i]), getOutputPath(folders.data[i]), getResultPath(folders.data[i]), EXECUTOR_MODES[j]);
+			}
+			for(int j = 0; RECOVERY_MODES[j].name != NULL; j++)
+			{
+				executeRecoveryTest(folders.data[i], getInputPath(folders.data[i]), getOutputPath(folders.data[i]), scratch, &RECOVERY_MODES[j]);
+			}
+			executeSeekTest(folders.data[i], getInputPath(folders.data[i]), scratch);
+			for(int j = 0; RING_MODES[j] != NULL; j++)
+			{
+				executeRingTest(folders.data[i], getInputPath(folders.data[i]), getOutputPath(folders.data[i]), scratch, RING_MODES[j]);
+			}
 			#ifdef DEBUG
 				printf("Finished tests in %s\n\n\n", folders.data[i]);
 			#endif
 		}
 
+		for(int j = 0; SERVER_MODES[j] != NULL; j++)
+		{
+			executeServerTests(folders, scratch, SERVER_MODES[j]);
+		}
+		executeBatchTests(folders, scratch);
+
 		printf("Finished all tests\n");
 	}
 
+	sprintf(command, "rm -f %s/*", scratch);
+	system(command);
+	rmdir(scratch);
+
 	return 0;
 }
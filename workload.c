@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// #define DEBUG
+
+#define MAX_STRING_SIZE 1000
+#define MIN_LINE_LENGTH 10
+#define MAX_LINE_LENGTH 120
+
+typedef enum boolean { false, true } t_boolean;
+
+// share of each command in a family, and how far changes, prints and undos go
+typedef struct family
+{
+	char *name;
+	int change;
+	int delete;
+	int print;
+	int undo;
+	int redo;
+	int maxChangeLines;
+	int maxPrintLines;
+	int maxUndo;
+	// edits go at the end of text most of the time, as when writing it
+	t_boolean append;
+} t_family;
+
+// number of lines of every version on the undo path, from the empty text
+typedef struct history
+{
+	int *numLines;
+	long current;
+	long last;
+	t_boolean timeTravel;
+} t_history;
+
+// shapes of the public tests, scaled up
+const t_family FAMILIES[] = {
+	{"writeonly", 90, 0, 10, 0, 0, 10, 10, 0, true},
+	{"bulkreads", 30, 0, 70, 0, 0, 10, 100, 0, false},
+	{"timeforachange", 55, 15, 30, 0, 0, 5, 20, 0, false},
+	{"rollingback", 40, 10, 25, 15, 10, 5, 20, 3, false},
+	{"alterninghistory", 30, 15, 25, 15, 15, 5, 20, 5, false},
+	{"rollercoaster", 20, 20, 25, 20, 15, 5, 20, -1, false},
+	{NULL}
+};
+
+const t_family *findFamily(char *);
+void generate(const t_family *, long, unsigned long long);
+void printLine(unsigned long long *, long);
+long getRandom(unsigned long long *, long);
+
+// workload of a family with the given number of commands, the same for the same seed
+int main(int argc, char *argv[])
+{
+	const t_family *family;
+
+	if (argc < 3 || (family = findFamily(argv[1])) == NULL)
+	{
+		fprintf(stderr, "usage: %s FAMILY COMMANDS [SEED]\n", argv[0]);
+		fprintf(stderr, "families:");
+		for (int i = 0; FAMILIES[i].name != NULL; i++)
+			fprintf(stderr, " %s", FAMILIES[i].name);
+		fprintf(stderr, "\n");
+		return 1;
+	}
+
+	generate(family, atol(argv[2]), argc > 3 ? strtoull(argv[3], NULL, 10) : 1);
+	return 0;
+}
+
+const t_family *findFamily(char *name)
+{
+	for (int i = 0; FAMILIES[i].name != NULL; i++)
+		if (strcmp(FAMILIES[i].name, name) == 0)
+			return &FAMILIES[i];
+	return NULL;
+}
+
+void generate(const t_family *family, long numCommands, unsigned long long seed)
+{
+	t_history history;
+	int total = family->change + family->delete + family->print + family->undo + family->redo;
+	int numLines;
+	long start;
+	long end;
+	long count;
+	long pick;
+	unsigned long long state = seed * 2654435761ULL + 1;
+
+	history.numLines = malloc(sizeof(int) * (numCommands + 1));
+	history.numLines[0] = 0;
+	history.current = 0;
+	history.last = 0;
+	history.timeTravel = false;
+
+	for (long i = 0; i < numCommands; i++)
+	{
+		numLines = history.numLines[history.current];
+		pick = getRandom(&state, total);
+
+		if (pick < family->change || numLines == 0)
+		{
+			// a change starts at most right after the last line
+			count = getRandom(&state, family->maxChangeLines) + 1;
+			if (family->append == true && getRandom(&state, 4) > 0)
+				start = numLines + 1;
+			else
+				start = getRandom(&state, numLines + 1) + 1;
+			end = start + count - 1;
+			printf("%ld,%ldc\n", start, end);
+			for (long j = 0; j < count; j++)
+				printLine(&state, i);
+			printf(".\n");
+			history.current++;
+			history.numLines[history.current] = end > numLines ? end : numLines;
+			history.last = history.current;
+			history.timeTravel = false;
+		}
+		else if (pick < family->change + family->delete)
+		{
+			start = getRandom(&state, numLines) + 1;
+			end = start + getRandom(&state, family->maxChangeLines);
+			if (end > numLines)
+				end = numLines;
+			printf("%ld,%ldd\n", start, end);
+			history.current++;
+			history.numLines[history.current] = numLines - (end - start + 1);
+			history.last = history.current;
+			history.timeTravel = false;
+		}
+		else if (pick < family->change + family->delete + family->print)
+		{
+			start = getRandom(&state, numLines) + 1;
+			end = start + getRandom(&state, family->maxPrintLines);
+			printf("%ld,%ldp\n", start, end);
+		}
+		else if (pick < family->change + family->delete + family->print + family->undo)
+		{
+			// rollercoaster goes anywhere back in history
+			count = getRandom(&state, family->maxUndo > 0 ? family->maxUndo : history.current + 1) + 1;
+			printf("%ldu\n", count);
+			history.current -= count < history.current ? count : history.current;
+			history.timeTravel = true;
+		}
+		else
+		{
+			count = getRandom(&state, family->maxUndo > 0 ? family->maxUndo : history.last - history.current + 1) + 1;
+			printf("%ldr\n", count);
+			// redo only goes forward after an undo
+			if (history.timeTravel == true)
+				history.current += count < history.last - history.current ? count : history.last - history.current;
+		}
+	}
+	printf("q\n");
+
+	#ifdef DEBUG
+		fprintf(stderr, "%s: %ld commands, %d lines at the end\n", family->name, numCommands, history.numLines[history.current]);
+	#endif
+
+	free(history.numLines);
+}
+
+// line of random words, with the command that wrote it
+void printLine(unsigned long long *state, long command)
+{
+	char line[MAX_STRING_SIZE];
+	int length = MIN_LINE_LENGTH + getRandom(state, MAX_LINE_LENGTH - MIN_LINE_LENGTH);
+	int i = sprintf(line, "%ld.", command);
+
+	while (i < length)
+	{
+		line[i] = getRandom(state, 8) == 0 ? ' ' : 'a' + getRandom(state, 26);
+		i++;
+	}
+	line[i] = '\0';
+	puts(line);
+}
+
+// xorshift, so every platform generates the same workload
+long getRandom(unsigned long long *state, long bound)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return bound > 0 ? (long) (*state % bound) : 0;
+}